@@ -0,0 +1,464 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lfr-tcp.h"
+#include "clock.h"
+#include "arq.h"
+
+struct arq_pool {
+    int free_count;
+    int16_t free[ARQ_POOL_SIZE];
+    uint8_t data[ARQ_POOL_SIZE][ARQ_BUF_SIZE];
+};
+
+_Static_assert(sizeof(struct arq_pool) <= ARQ_POOL_STATE_MAX,
+               "ARQ_POOL_STATE_MAX is too small");
+
+static struct arq_pool pool;
+static arq_xmit_fn xmit;
+static arq_deliver_fn deliver;
+
+static int16_t buf_alloc(void)
+{
+    if (pool.free_count == 0) {
+        return -1;
+    }
+    return pool.free[--pool.free_count];
+}
+
+static void buf_free(int16_t b)
+{
+    pool.free[pool.free_count++] = b;
+}
+
+/* Whether seq is in [from, from + n) */
+static int seq_in(uint8_t seq, uint8_t from, int n)
+{
+    return (uint8_t) (seq - from) < n;
+}
+
+static void fill_ack(const struct arq_state *a, struct link_arq *h)
+{
+    int i;
+
+    h->flags |= LINK_F_ARQ_ACK;
+    h->ack = a->rcv_nxt;
+    h->sack = 0;
+
+    // A sender's window reaches at most ARQ_WINDOW - 1 past rcv_nxt
+    for (i = 0; i < ARQ_WINDOW - 1; i++) {
+        if (a->rx_buf[(uint8_t) (a->rcv_nxt + 1 + i) % ARQ_WINDOW] >= 0) {
+            h->sack |= 1u << i;
+        }
+    }
+}
+
+static uint64_t slot_rto(const struct arq_state *a, const struct arq_slot *s)
+{
+    uint64_t rto = a->rto;
+    int i;
+
+    // Back off on each timeout; a fast retransmit says the link is moving
+    for (i = 0; i < s->timeouts && rto < ARQ_RTO_MAX_NS; i++) {
+        rto *= 2;
+    }
+
+    return rto < ARQ_RTO_MAX_NS ? rto : ARQ_RTO_MAX_NS;
+}
+
+static int slot_xmit(struct arq_state *a, struct arq_slot *s)
+{
+    struct link_arq h;
+    uint64_t now = now_ns();
+    int err;
+
+    h.flags = LINK_F_ARQ_DATA;
+    h.seq = s->seq;
+    h.base = a->snd_una;
+    fill_ack(a, &h);
+
+    err = xmit(a->port, &h, pool.data[s->buf], s->len);
+    if (err == 0) {
+        s->tries++;
+        s->order = a->tx_order++;
+        s->sent_at = now;
+        // The ACK went with it
+        timer_stop(&a->ack_timer);
+    }
+
+    // A send the link had no room for is tried again by the timer
+    timer_start(&s->timer, now + slot_rto(a, s));
+
+    return err;
+}
+
+static void rtt_sample(struct arq_state *a, uint64_t rtt)
+{
+    uint64_t diff;
+
+    if (a->srtt == 0) {
+        a->srtt = rtt;
+        a->rttvar = rtt / 2;
+    } else {
+        diff = a->srtt > rtt ? a->srtt - rtt : rtt - a->srtt;
+        a->rttvar = (3 * a->rttvar + diff) / 4;
+        a->srtt = (7 * a->srtt + rtt) / 8;
+    }
+
+    a->rto = a->srtt + (4 * a->rttvar > 2 * TIMER_TICK_NS ?
+                        4 * a->rttvar : 2 * TIMER_TICK_NS);
+    if (a->rto < ARQ_RTO_MIN_NS) {
+        a->rto = ARQ_RTO_MIN_NS;
+    } else if (a->rto > ARQ_RTO_MAX_NS) {
+        a->rto = ARQ_RTO_MAX_NS;
+    }
+}
+
+static void slot_release(struct arq_slot *s)
+{
+    buf_free(s->buf);
+    s->buf = -1;
+    timer_stop(&s->timer);
+}
+
+static void advance(struct arq_state *a)
+{
+    while (a->snd_una != a->snd_nxt &&
+           a->tx[a->snd_una % ARQ_WINDOW].buf < 0) {
+        a->snd_una++;
+    }
+}
+
+static void rtx_timeout(void *arg)
+{
+    struct arq_slot *s = arg;
+    struct arq_state *a = s->owner;
+    uint64_t due = s->sent_at + slot_rto(a, s);
+
+    // The estimate has grown since it was sent, wait the rest of it out
+    if (s->tries && due > now_ns()) {
+        timer_start(&s->timer, due);
+        return;
+    }
+
+    if (s->tries >= ARQ_MAX_TRIES) {
+        log_err("ERROR ARQ on KISS port %d: no ACK for frame %d after %d "
+                "tries, dropping it\n", a->port, s->seq, s->tries);
+        slot_release(s);
+        a->given_up++;
+        advance(a);
+        return;
+    }
+
+    a->retransmits++;
+    s->timeouts++;
+    slot_xmit(a, s);
+}
+
+static void ack_timeout(void *arg)
+{
+    struct arq_state *a = arg;
+    struct link_arq h;
+    uint8_t none = 0;
+
+    h.flags = 0;
+    fill_ack(a, &h);
+
+    if (xmit(a->port, &h, &none, 0) == -2) {
+        timer_start(&a->ack_timer, now_ns() + ARQ_ACK_DELAY_NS);
+    }
+}
+
+void arq_init(arq_xmit_fn xmit_fn, arq_deliver_fn deliver_fn)
+{
+    int i;
+
+    xmit = xmit_fn;
+    deliver = deliver_fn;
+
+    for (i = 0; i < ARQ_POOL_SIZE; i++) {
+        pool.free[i] = ARQ_POOL_SIZE - 1 - i;
+    }
+    pool.free_count = ARQ_POOL_SIZE;
+}
+
+void arq_reset(struct arq_state *a, int port)
+{
+    int i;
+
+    memset(a, 0, sizeof(*a));
+    a->port = port;
+    a->rto = ARQ_RTO_INIT_NS;
+
+    for (i = 0; i < ARQ_WINDOW; i++) {
+        a->tx[i].buf = -1;
+        a->tx[i].owner = a;
+        timer_init(&a->tx[i].timer, rtx_timeout, &a->tx[i]);
+        a->rx_buf[i] = -1;
+    }
+    timer_init(&a->ack_timer, ack_timeout, a);
+}
+
+void arq_clear(struct arq_state *a)
+{
+    int i;
+
+    for (i = 0; i < ARQ_WINDOW; i++) {
+        if (a->tx[i].buf >= 0) {
+            slot_release(&a->tx[i]);
+        }
+        if (a->rx_buf[i] >= 0) {
+            buf_free(a->rx_buf[i]);
+            a->rx_buf[i] = -1;
+        }
+    }
+    timer_stop(&a->ack_timer);
+}
+
+void arq_resume(struct arq_state *a)
+{
+    uint64_t now = now_ns();
+    int i;
+
+    for (i = 0; i < ARQ_WINDOW; i++) {
+        struct arq_slot *s = &a->tx[i];
+
+        s->owner = a;
+        timer_init(&s->timer, rtx_timeout, s);
+        if (s->buf >= 0) {
+            timer_start(&s->timer, now + slot_rto(a, s));
+        }
+    }
+
+    // A pending ACK is dropped; the peer's retransmit draws another
+    timer_init(&a->ack_timer, ack_timeout, a);
+}
+
+int arq_send(struct arq_state *a, const uint8_t *buf, int len)
+{
+    struct arq_slot *s;
+    int16_t b;
+    int err;
+
+    if (len > ARQ_BUF_SIZE) {
+        return -1;
+    }
+
+    if ((uint8_t) (a->snd_nxt - a->snd_una) >= ARQ_WINDOW) {
+        return -2;
+    }
+
+    b = buf_alloc();
+    if (b < 0) {
+        return -2;
+    }
+
+    s = &a->tx[a->snd_nxt % ARQ_WINDOW];
+    s->buf = b;
+    s->seq = a->snd_nxt;
+    s->len = len;
+    s->tries = 0;
+    s->timeouts = 0;
+    memcpy(pool.data[b], buf, len);
+    a->snd_nxt++;
+
+    err = slot_xmit(a, s);
+    if (err < 0) {
+        // Never went out, so the sequence number can be used again
+        slot_release(s);
+        a->snd_nxt--;
+    }
+
+    return err;
+}
+
+/**
+ * Release a frame the peer has, noting its round trip and send order
+ */
+static void slot_acked(struct arq_state *a, struct arq_slot *s, uint64_t now,
+                       int *acked, uint32_t *newest)
+{
+    if (s->buf < 0) {
+        return;
+    }
+
+    // Only a frame sent once gives an unambiguous round trip and send
+    // order; the ACK of a resent one may be for its first copy
+    if (s->tries == 1) {
+        rtt_sample(a, now - s->sent_at);
+        if (!*acked || (int32_t) (s->order - *newest) > 0) {
+            *newest = s->order;
+        }
+        *acked = 1;
+    }
+    slot_release(s);
+}
+
+/**
+ * Take the acknowledgement in a received frame
+ */
+static void ack_input(struct arq_state *a, const struct link_arq *h)
+{
+    uint8_t in_flight = a->snd_nxt - a->snd_una;
+    uint64_t now = now_ns();
+    uint32_t newest = 0;
+    int acked = 0;
+    uint8_t seq;
+    int i;
+
+    // An ACK for frames we never sent is from before a restart
+    if (!seq_in(h->ack, a->snd_una, in_flight + 1)) {
+        return;
+    }
+
+    for (seq = a->snd_una; seq != h->ack; seq++) {
+        slot_acked(a, &a->tx[seq % ARQ_WINDOW], now, &acked, &newest);
+    }
+
+    for (i = 0; i < ARQ_WINDOW - 1; i++) {
+        seq = h->ack + 1 + i;
+        if ((h->sack & (1u << i)) && seq_in(seq, a->snd_una, in_flight)) {
+            slot_acked(a, &a->tx[seq % ARQ_WINDOW], now, &acked, &newest);
+        }
+    }
+
+    advance(a);
+
+    if (!acked) {
+        return;
+    }
+
+    // The link keeps order, so a frame sent before one that got through
+    // was lost. Resend it now rather than waiting for its timer.
+    for (seq = a->snd_una; seq != a->snd_nxt; seq++) {
+        struct arq_slot *s = &a->tx[seq % ARQ_WINDOW];
+
+        if (s->buf >= 0 && (int32_t) (s->order - newest) < 0) {
+            a->retransmits++;
+            slot_xmit(a, s);
+        }
+    }
+}
+
+/**
+ * Deliver the frame at rcv_nxt if it arrived early, and move on
+ * @return 1 if there was one
+ */
+static int deliver_held(struct arq_state *a)
+{
+    int i = a->rcv_nxt % ARQ_WINDOW;
+    int16_t b = a->rx_buf[i];
+
+    a->rcv_nxt++;
+    if (b < 0) {
+        return 0;
+    }
+
+    a->rx_buf[i] = -1;
+    deliver(a->port, pool.data[b], a->rx_len[i]);
+    buf_free(b);
+    return 1;
+}
+
+static void deliver_in_order(struct arq_state *a)
+{
+    while (a->rx_buf[a->rcv_nxt % ARQ_WINDOW] >= 0) {
+        deliver_held(a);
+    }
+}
+
+/**
+ * Move the receive window up to the sender's base, because the sender
+ * gave up on the frames before it or restarted
+ */
+static void skip_to(struct arq_state *a, uint8_t base)
+{
+    log_info("ARQ on KISS port %d: skipping from frame %d to %d\n", a->port,
+             a->rcv_nxt, base);
+
+    // Whatever arrived early still goes out, in order
+    while (a->rcv_nxt != base) {
+        deliver_held(a);
+    }
+
+    deliver_in_order(a);
+}
+
+static void data_input(struct arq_state *a, const struct link_arq *h,
+                       const uint8_t *buf, int len)
+{
+    uint8_t d;
+
+    // Normally the base trails what we have delivered by up to a window
+    if (!seq_in(a->rcv_nxt, h->base, ARQ_WINDOW + 1)) {
+        skip_to(a, h->base);
+    }
+
+    d = h->seq - a->rcv_nxt;
+    if (d == 0) {
+        a->rcv_nxt++;
+        deliver(a->port, (uint8_t *) buf, len);
+        deliver_in_order(a);
+    } else if (d < ARQ_WINDOW && a->rx_buf[h->seq % ARQ_WINDOW] < 0 &&
+               len <= ARQ_BUF_SIZE) {
+        // Early; hold it if there is room, else it will be sent again
+        int16_t b = buf_alloc();
+
+        if (b >= 0) {
+            memcpy(pool.data[b], buf, len);
+            a->rx_buf[h->seq % ARQ_WINDOW] = b;
+            a->rx_len[h->seq % ARQ_WINDOW] = len;
+        }
+    }
+
+    // Duplicates are acknowledged too, the last ACK may have been lost
+    if (!timer_pending(&a->ack_timer)) {
+        timer_start(&a->ack_timer, now_ns() + ARQ_ACK_DELAY_NS);
+    }
+}
+
+void arq_input(struct arq_state *a, const struct link_arq *arq,
+               const uint8_t *buf, int len)
+{
+    if (arq->flags & LINK_F_ARQ_ACK) {
+        ack_input(a, arq);
+    }
+
+    if (arq->flags & LINK_F_ARQ_DATA) {
+        data_input(a, arq, buf, len);
+    }
+}
+
+int arq_in_flight(const struct arq_state *a)
+{
+    int n = 0;
+    int i;
+
+    for (i = 0; i < ARQ_WINDOW; i++) {
+        n += a->tx[i].buf >= 0;
+    }
+
+    return n;
+}
+
+const void *arq_pool_export(int *len)
+{
+    *len = sizeof(pool);
+    return &pool;
+}
+
+int arq_pool_import(const void *buf, int len)
+{
+    if (len != sizeof(pool)) {
+        return -1;
+    }
+
+    memcpy(&pool, buf, len);
+    return 0;
+}
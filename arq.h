@@ -0,0 +1,171 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef ARQ_H
+#define ARQ_H
+
+#include <stdint.h>
+
+#include "link.h"
+#include "timer.h"
+
+/*
+ * Selective-repeat ARQ between two bridges
+ *
+ * Data frames carry an 8-bit sequence number and the sender's window base.
+ * The receiver delivers frames in order, holds ones that arrive early, and
+ * answers with the next sequence number it expects plus a bitmap of the
+ * frames after it that it already holds, either in a data frame going the
+ * other way or in a short ACK frame after ARQ_ACK_DELAY_NS. Each frame in
+ * flight has its own retransmit timer, and a frame is resent at once when a
+ * frame sent after it is acknowledged first, since the link keeps order.
+ * Unacknowledged and early frames are kept in buffers from one fixed pool
+ * shared by all ports.
+ */
+
+/* Frames in flight per port; the SACK bitmap covers the window */
+#define ARQ_WINDOW 32
+
+/* Buffers shared by all ports, for both directions */
+#define ARQ_POOL_SIZE 256
+#define ARQ_BUF_SIZE 255
+
+/* Upper bound on the size of arq_pool_export() */
+#define ARQ_POOL_STATE_MAX (ARQ_POOL_SIZE * (ARQ_BUF_SIZE + 2) + 16)
+
+#define ARQ_ACK_DELAY_NS (10 * NS_PER_MS)
+#define ARQ_RTO_INIT_NS (1 * NS_PER_SEC)
+/* Round trips grow as the window fills the link's queue, so keep some slack */
+#define ARQ_RTO_MIN_NS (200 * NS_PER_MS)
+#define ARQ_RTO_MAX_NS (10 * NS_PER_SEC)
+
+/* A frame sent this many times without an ACK is given up on */
+#define ARQ_MAX_TRIES 16
+
+struct arq_state;
+
+/**
+ * A frame in flight
+ */
+struct arq_slot {
+    int16_t buf;        // pool buffer, -1 once acknowledged
+    uint8_t seq;
+    uint8_t len;
+    uint8_t tries;
+    uint8_t timeouts;
+    uint32_t order;     // frames sent on the port before its last send
+    uint64_t sent_at;
+    struct timer timer;
+    struct arq_state *owner;
+};
+
+/**
+ * ARQ state of one port
+ * Plain data apart from the timers and owner pointers, which arq_resume()
+ * sets up again after the state is copied.
+ */
+struct arq_state {
+    int port;
+
+    // Sending
+    uint8_t snd_una;    // oldest frame not yet acknowledged
+    uint8_t snd_nxt;    // next sequence number to send
+    uint32_t tx_order;
+    uint64_t srtt;
+    uint64_t rttvar;
+    uint64_t rto;
+    struct arq_slot tx[ARQ_WINDOW]; // by sequence number % ARQ_WINDOW
+
+    // Receiving
+    uint8_t rcv_nxt;    // next frame to deliver
+    int16_t rx_buf[ARQ_WINDOW];     // early frames, -1 for none
+    uint8_t rx_len[ARQ_WINDOW];
+    struct timer ack_timer;
+
+    uint32_t retransmits;
+    uint32_t given_up;
+};
+
+/**
+ * Send a frame on the link with ARQ fields
+ * @param port the port
+ * @param arq the ARQ fields
+ * @param buf the frame
+ * @param len the length of the frame
+ * @return 0 on success, -1 on error, -2 if the link is backed up
+ */
+typedef int (*arq_xmit_fn)(int port, const struct link_arq *arq,
+                           const uint8_t *buf, int len);
+
+/**
+ * Pass a frame, in order, to the port's client
+ */
+typedef void (*arq_deliver_fn)(int port, uint8_t *buf, int len);
+
+/**
+ * Set the callbacks and empty the buffer pool
+ */
+void arq_init(arq_xmit_fn xmit, arq_deliver_fn deliver);
+
+/**
+ * Start a port from sequence number 0
+ * Release anything the state held with arq_clear() first.
+ * @param a the port's state
+ * @param port the port, passed to the callbacks
+ */
+void arq_reset(struct arq_state *a, int port);
+
+/**
+ * Release a port's buffers and stop its timers
+ */
+void arq_clear(struct arq_state *a);
+
+/**
+ * Restart the timers of state copied from another process
+ */
+void arq_resume(struct arq_state *a);
+
+/**
+ * Send a frame reliably
+ * @param a the port's state
+ * @param buf the frame
+ * @param len the length of the frame, at most ARQ_BUF_SIZE
+ * @return 0 once sent, -1 on error, -2 if the window or pool is full or
+ *         the link is backed up
+ */
+int arq_send(struct arq_state *a, const uint8_t *buf, int len);
+
+/**
+ * Handle a received frame's ARQ fields and deliver what is now in order
+ * @param a the port's state
+ * @param arq the frame's ARQ fields
+ * @param buf the frame body
+ * @param len the length of the body
+ */
+void arq_input(struct arq_state *a, const struct link_arq *arq,
+               const uint8_t *buf, int len);
+
+/**
+ * Frames sent and not yet acknowledged
+ */
+int arq_in_flight(const struct arq_state *a);
+
+/**
+ * The buffer pool, for handing off to a new process
+ * @param len set to the size of the pool state
+ * @return the pool state
+ */
+const void *arq_pool_export(int *len);
+
+/**
+ * Take over a buffer pool from another process
+ * @param buf the pool state from arq_pool_export()
+ * @param len its size
+ * @return 0 on success, -1 if the size does not match
+ */
+int arq_pool_import(const void *buf, int len);
+
+#endif
@@ -0,0 +1,273 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "lfr-tcp.h"
+#include "ax25.h"
+
+#define AX25_ALLOW (AX25_ALLOW_DST | AX25_ALLOW_SRC)
+
+static int addr_char_ok(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == ' ';
+}
+
+static int decode_addr(const uint8_t *p, struct ax25_addr *addr)
+{
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        // Only the last byte of the SSID carries the extension bit
+        if (p[i] & 1) {
+            return -1;
+        }
+        addr->call[i] = p[i] >> 1;
+        if (!addr_char_ok(addr->call[i])) {
+            return -1;
+        }
+    }
+    addr->call[6] = '\0';
+    addr->ssid = (p[6] >> 1) & 0x0F;
+
+    return 0;
+}
+
+int ax25_parse(const uint8_t *frame, int len, struct ax25_addr *dst,
+               struct ax25_addr *src)
+{
+    if (len < 2 * AX25_ADDR_LEN) {
+        return -1;
+    }
+
+    // The destination never ends the address field
+    if (frame[AX25_ADDR_LEN - 1] & 1) {
+        return -1;
+    }
+
+    if (decode_addr(frame, dst) < 0 ||
+        decode_addr(&frame[AX25_ADDR_LEN], src) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int ax25_addr_parse(const char *s, struct ax25_addr *addr)
+{
+    const char *dash = strchr(s, '-');
+    int n = dash ? dash - s : (int) strlen(s);
+    int i;
+
+    if (n < 1 || n > 6) {
+        return -1;
+    }
+
+    memset(addr->call, ' ', 6);
+    addr->call[6] = '\0';
+    for (i = 0; i < n; i++) {
+        addr->call[i] = toupper((unsigned char) s[i]);
+        if (addr->call[i] == ' ' || !addr_char_ok(addr->call[i])) {
+            return -1;
+        }
+    }
+
+    addr->ssid = AX25_SSID_ANY;
+    if (dash) {
+        char *end;
+        long ssid = strtol(dash + 1, &end, 10);
+
+        if (end == dash + 1 || *end != '\0' || ssid < 0 || ssid > 15) {
+            return -1;
+        }
+        addr->ssid = ssid;
+    }
+
+    return 0;
+}
+
+/* FNV-1a over the callsign and SSID */
+static uint32_t addr_hash(const struct ax25_addr *addr)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        h = (h ^ (uint8_t) addr->call[i]) * 16777619u;
+    }
+    h = (h ^ addr->ssid) * 16777619u;
+
+    return h;
+}
+
+static int addr_equal(const struct ax25_addr *a, const struct ax25_addr *b)
+{
+    return a->ssid == b->ssid && memcmp(a->call, b->call, 6) == 0;
+}
+
+/**
+ * Find a station's slot, or the empty slot where it would go
+ */
+static int filter_find(const struct ax25_filter *f,
+                       const struct ax25_addr *addr)
+{
+    uint32_t i = addr_hash(addr) & (AX25_FILTER_SLOTS - 1);
+
+    // Never full, so an empty slot ends every probe
+    while (f->slot[i].flags && !addr_equal(&f->slot[i].addr, addr)) {
+        i = (i + 1) & (AX25_FILTER_SLOTS - 1);
+    }
+
+    return i;
+}
+
+static uint8_t filter_flags(const struct ax25_filter *f,
+                            struct ax25_addr *addr)
+{
+    uint8_t flags;
+    uint8_t ssid = addr->ssid;
+
+    flags = f->slot[filter_find(f, addr)].flags;
+    addr->ssid = AX25_SSID_ANY;
+    flags |= f->slot[filter_find(f, addr)].flags;
+    addr->ssid = ssid;
+
+    return flags;
+}
+
+void ax25_filter_clear(struct ax25_filter *f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+int ax25_filter_add(struct ax25_filter *f, const struct ax25_addr *addr,
+                    uint8_t flags)
+{
+    struct ax25_filter_entry *e = &f->slot[filter_find(f, addr)];
+
+    if (!e->flags) {
+        if (f->count == AX25_FILTER_MAX) {
+            return -1;
+        }
+        e->addr = *addr;
+        f->count++;
+    }
+
+    if (!(e->flags & AX25_ALLOW) && (flags & AX25_ALLOW)) {
+        f->num_allow++;
+    }
+    e->flags |= flags;
+
+    return 0;
+}
+
+int ax25_filter_load(struct ax25_filter *f, const char *path)
+{
+    char line[256];
+    int lineno = 0;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file) {
+        log_err("ERROR opening filter %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    ax25_filter_clear(f);
+
+    while (fgets(line, sizeof(line), file)) {
+        char *comment = strchr(line, '#');
+        char *action;
+        char *field;
+        char *call;
+        struct ax25_addr addr;
+        uint8_t flags;
+
+        lineno++;
+        if (comment) {
+            *comment = '\0';
+        }
+
+        action = strtok(line, " \t\r\n");
+        field = strtok(NULL, " \t\r\n");
+        call = strtok(NULL, " \t\r\n");
+        if (!action) {
+            continue;
+        }
+
+        if (!field || !call || strtok(NULL, " \t\r\n") ||
+            ax25_addr_parse(call, &addr) < 0) {
+            goto bad;
+        }
+
+        if (strcmp(field, "dst") == 0) {
+            flags = AX25_ALLOW_DST;
+        } else if (strcmp(field, "src") == 0) {
+            flags = AX25_ALLOW_SRC;
+        } else if (strcmp(field, "any") == 0) {
+            flags = AX25_ALLOW;
+        } else {
+            goto bad;
+        }
+
+        if (strcmp(action, "deny") == 0) {
+            flags <<= 2;
+        } else if (strcmp(action, "allow") != 0) {
+            goto bad;
+        }
+
+        if (ax25_filter_add(f, &addr, flags) < 0) {
+            log_err("ERROR filter %s is over %d stations\n", path,
+                    AX25_FILTER_MAX);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+
+bad:
+    log_err("ERROR filter %s line %d: expected allow|deny dst|src|any "
+            "CALL[-SSID]\n", path, lineno);
+    fclose(file);
+    return -1;
+}
+
+int ax25_filter_accept(const struct ax25_filter *f, const uint8_t *frame,
+                       int len)
+{
+    struct ax25_addr dst;
+    struct ax25_addr src;
+    uint8_t dst_flags;
+    uint8_t src_flags;
+
+    if (f->count == 0) {
+        return 1;
+    }
+
+    if (ax25_parse(frame, len, &dst, &src) < 0) {
+        return f->num_allow == 0;
+    }
+
+    dst_flags = filter_flags(f, &dst);
+    src_flags = filter_flags(f, &src);
+
+    if ((dst_flags & AX25_DENY_DST) || (src_flags & AX25_DENY_SRC)) {
+        return 0;
+    }
+
+    if (f->num_allow == 0) {
+        return 1;
+    }
+
+    return (dst_flags & AX25_ALLOW_DST) || (src_flags & AX25_ALLOW_SRC);
+}
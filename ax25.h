@@ -0,0 +1,109 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef AX25_H
+#define AX25_H
+
+#include <stdint.h>
+
+/*
+ * AX.25 addresses and a callsign filter for received frames
+ *
+ * The filter is a hash table of callsign and SSID, each entry saying
+ * whether it allows or denies frames to (dst) or from (src) that station.
+ * A frame is dropped if its source or destination is denied. If there are
+ * any allow entries, it is also dropped unless its source or destination
+ * is allowed. Frames without a valid AX.25 address header match nothing.
+ */
+
+/* Bytes in an encoded address: six shifted characters and the SSID byte */
+#define AX25_ADDR_LEN 7
+
+/* Matches every SSID of a callsign */
+#define AX25_SSID_ANY 0xFF
+
+/* Hash table size, a power of two, and how full it may get */
+#define AX25_FILTER_SLOTS 1024
+#define AX25_FILTER_MAX 512
+
+#define AX25_ALLOW_DST 0x01
+#define AX25_ALLOW_SRC 0x02
+#define AX25_DENY_DST  0x04
+#define AX25_DENY_SRC  0x08
+
+struct ax25_addr {
+    char call[7];   // space padded, NUL terminated
+    uint8_t ssid;   // 0 to 15, or AX25_SSID_ANY
+};
+
+struct ax25_filter_entry {
+    struct ax25_addr addr;
+    uint8_t flags;  // AX25_ALLOW_* and AX25_DENY_*, 0 for an empty slot
+};
+
+struct ax25_filter {
+    int count;
+    int num_allow;
+    struct ax25_filter_entry slot[AX25_FILTER_SLOTS];
+};
+
+/**
+ * Decode the destination and source addresses at the head of a frame
+ * @param frame the frame
+ * @param len the length of the frame
+ * @param dst set to the destination
+ * @param src set to the source
+ * @return 0 on success, -1 if the frame has no valid address header
+ */
+int ax25_parse(const uint8_t *frame, int len, struct ax25_addr *dst,
+               struct ax25_addr *src);
+
+/**
+ * Parse a callsign such as "W2UB-3" or "W2UB" (any SSID)
+ * @param s the text
+ * @param addr set to the address
+ * @return 0 on success, -1 if it is not a valid callsign
+ */
+int ax25_addr_parse(const char *s, struct ax25_addr *addr);
+
+/**
+ * Empty a filter
+ * @param f the filter
+ */
+void ax25_filter_clear(struct ax25_filter *f);
+
+/**
+ * Add a rule to a filter
+ * @param f the filter
+ * @param addr the station, ssid may be AX25_SSID_ANY
+ * @param flags one or more of AX25_ALLOW_* and AX25_DENY_*
+ * @return 0 on success, -1 if the filter is full
+ */
+int ax25_filter_add(struct ax25_filter *f, const struct ax25_addr *addr,
+                    uint8_t flags);
+
+/**
+ * Replace a filter with the rules in a file
+ * Each line is "allow" or "deny", then "dst", "src" or "any", then a
+ * callsign. Anything after a # is a comment. On error the filter is left
+ * half loaded, so load into a spare.
+ * @param f the filter
+ * @param path the file
+ * @return 0 on success, -1 on error
+ */
+int ax25_filter_load(struct ax25_filter *f, const char *path);
+
+/**
+ * Decide whether to keep a received frame
+ * @param f the filter
+ * @param frame the frame
+ * @param len the length of the frame
+ * @return 1 to keep the frame, 0 to drop it
+ */
+int ax25_filter_accept(const struct ax25_filter *f, const uint8_t *frame,
+                       int len);
+
+#endif
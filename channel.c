@@ -0,0 +1,143 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "clock.h"
+#include "channel.h"
+
+struct channel_frame {
+    uint64_t due;
+    int len;
+    uint8_t data[CHANNEL_FRAME_MAX];
+};
+
+/**
+ * One direction of the link
+ */
+struct channel_dir {
+    uint64_t air_free;  // when the transmitter finishes its last frame
+    int head;
+    int count;
+    struct channel_frame q[CHANNEL_QUEUE_LEN];
+};
+
+static struct channel_model model;
+static struct channel_dir dirs[2];
+static uint64_t rng_state;
+
+/* xorshift64*, so a seed gives the same run on every platform */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void flip_bits(uint8_t *buf, int len)
+{
+    uint64_t bits = (uint64_t) len * 8;
+    uint64_t i = 0;
+
+    // Skip ahead by geometric gaps rather than drawing for every bit
+    while (1) {
+        double u = rng_uniform();
+        if (u <= 0) continue;
+        i += (uint64_t) (log(u) / log1p(-model.ber));
+        if (i >= bits) break;
+        buf[i / 8] ^= 0x80 >> (i % 8);
+        i++;
+    }
+}
+
+void channel_init(const struct channel_model *m, uint64_t seed)
+{
+    model = *m;
+    memset(dirs, 0, sizeof(dirs));
+    // xorshift must not start at 0
+    rng_state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+int channel_send(int from, const uint8_t *buf, int len)
+{
+    struct channel_dir *d = &dirs[from];
+    struct channel_frame *f;
+    uint64_t now = now_ns();
+
+    if (len > CHANNEL_FRAME_MAX) {
+        return -1;
+    }
+
+    if (d->count == CHANNEL_QUEUE_LEN) {
+        return -2;
+    }
+
+    // Frames go out back to back at the link bit rate
+    if (d->air_free < now) {
+        d->air_free = now;
+    }
+    if (model.bitrate) {
+        d->air_free += (uint64_t) len * 8 * NS_PER_SEC / model.bitrate;
+    }
+
+    // A lost frame still used its airtime
+    if (model.loss > 0 && rng_uniform() < model.loss) {
+        return 0;
+    }
+
+    f = &d->q[(d->head + d->count) % CHANNEL_QUEUE_LEN];
+    f->due = d->air_free + model.delay_ns;
+    f->len = len;
+    memcpy(f->data, buf, len);
+    if (model.ber > 0) {
+        flip_bits(f->data, len);
+    }
+    d->count++;
+
+    return 0;
+}
+
+uint64_t channel_next_due(void)
+{
+    uint64_t due = CHANNEL_IDLE;
+    int i;
+
+    // Delivery times only grow within a direction, so the heads decide
+    for (i = 0; i < 2; i++) {
+        if (dirs[i].count && dirs[i].q[dirs[i].head].due < due) {
+            due = dirs[i].q[dirs[i].head].due;
+        }
+    }
+
+    return due;
+}
+
+void channel_poll(uint64_t now, channel_deliver_fn deliver)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        struct channel_dir *d = &dirs[i];
+
+        while (d->count && d->q[d->head].due <= now) {
+            struct channel_frame *f = &d->q[d->head];
+
+            // Side i sent it, the other side receives it. The slot stays
+            // taken until the callback is done with it.
+            deliver(!i, f->data, f->len);
+            d->head = (d->head + 1) % CHANNEL_QUEUE_LEN;
+            d->count--;
+        }
+    }
+}
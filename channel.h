@@ -0,0 +1,81 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+
+#include "fec.h"
+
+/*
+ * In-memory radio channel between two sides (0 = SAT, 1 = GND)
+ *
+ * Used instead of a KISS TNC in loopback mode. Each direction is a FIFO of
+ * wire frames with a delivery time; the models below are all optional.
+ */
+
+#define CHANNEL_SAT 0
+#define CHANNEL_GND 1
+
+/* Frames in flight per direction */
+#define CHANNEL_QUEUE_LEN 256
+
+/* Largest wire frame, after link framing and FEC */
+#define CHANNEL_FRAME_MAX FEC_MAX_FRAME
+
+/* Returned by channel_next_due() when nothing is in flight */
+#define CHANNEL_IDLE UINT64_MAX
+
+/**
+ * Channel impairments, all zero for a perfect link
+ */
+struct channel_model {
+    double loss;        // probability a frame is lost
+    double ber;         // probability each bit is flipped
+    uint64_t delay_ns;  // one-way propagation delay
+    uint32_t bitrate;   // bits per second, 0 for no limit
+};
+
+/**
+ * Called for each frame as it arrives
+ * @param to the receiving side
+ * @param buf the frame, may be modified
+ * @param len the length of the frame
+ */
+typedef void (*channel_deliver_fn)(int to, uint8_t *buf, int len);
+
+/**
+ * Reset the channel
+ * @param model the impairments to apply
+ * @param seed seed for the loss and bit error draws
+ */
+void channel_init(const struct channel_model *model, uint64_t seed);
+
+/**
+ * Put a frame on the air
+ * @param from the sending side
+ * @param buf the frame
+ * @param len the length of the frame, at most CHANNEL_FRAME_MAX
+ * @return 0 on success (including a frame that will be lost), -1 if the
+ *         frame is too long, -2 if too many frames are in flight
+ */
+int channel_send(int from, const uint8_t *buf, int len);
+
+/**
+ * When the next frame arrives
+ * @return the arrival time in ns (see now_ns()), or CHANNEL_IDLE
+ */
+uint64_t channel_next_due(void);
+
+/**
+ * Deliver every frame that has arrived by now
+ * @param now the current time in ns
+ * @param deliver called for each frame, in arrival order per direction
+ */
+void channel_poll(uint64_t now, channel_deliver_fn deliver);
+
+#endif
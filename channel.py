@@ -5,8 +5,16 @@ GND_PORT = 52002
 
 import socket, select
 import random
+import argparse
 from time import sleep
 
+parser = argparse.ArgumentParser(description='Simulated radio channel between two KISS TNCs')
+parser.add_argument('--loss', type=float, default=1.0,
+                    help='percentage of frames dropped (default 1)')
+parser.add_argument('--ber', type=float, default=0.0,
+                    help='bit error rate applied to delivered frames (default 0)')
+args = parser.parse_args()
+
 FEND = 0xC0
 FESC = 0xDB
 TFEND = 0xDC
@@ -15,6 +23,24 @@ TFESC = 0xDD
 def percent(p):
     return random.random() < (p / 100.)
 
+def corrupt(msg):
+    """Flip each bit of msg independently with probability args.ber"""
+    if args.ber <= 0:
+        return msg, 0
+
+    data = bytearray(msg)
+    flips = 0
+    # Skip ahead geometrically rather than drawing per bit
+    i = -1
+    while True:
+        i += 1 + int(random.expovariate(args.ber))
+        if i >= len(data) * 8:
+            break
+        data[i // 8] ^= 0x80 >> (i % 8)
+        flips += 1
+
+    return bytes(data), flips
+
 def hexdump(src, length=16, sep='.'):
     FILTER = ''.join([(len(repr(chr(x))) == 3) and chr(x) or sep for x in range(256)])
     lines = []
@@ -29,8 +55,12 @@ def hexdump(src, length=16, sep='.'):
 
 def uplink_filter(msg):
     sleep((len(msg) + 9) * 8 / 10000 + 0.004)
-    if percent(99):
-        print('GND>\n{}'.format(hexdump(msg)))
+    if not percent(args.loss):
+        msg, flips = corrupt(msg)
+        if flips:
+            print('\033[1;33mGND> ({} bit errors)\n{}\033[0;0m'.format(flips, hexdump(msg)))
+        else:
+            print('GND>\n{}'.format(hexdump(msg)))
         return msg
     else:
         print('\033[1;31mGND>\n{}\033[0;0m'.format(hexdump(msg)))
@@ -38,8 +68,12 @@ def uplink_filter(msg):
 
 def downlink_filter(msg):
     sleep((len(msg) + 9) * 8 / 10000 + 0.004)
-    if percent(99):
-        print('SAT>\n{}'.format(hexdump(msg)))
+    if not percent(args.loss):
+        msg, flips = corrupt(msg)
+        if flips:
+            print('\033[1;33mSAT> ({} bit errors)\n{}\033[0;0m'.format(flips, hexdump(msg)))
+        else:
+            print('SAT>\n{}'.format(hexdump(msg)))
         return msg
     else:
         print('\033[1;31mSAT>\n{}\033[0;0m'.format(hexdump(msg)))
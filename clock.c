@@ -0,0 +1,67 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "clock.h"
+
+static int virtual = 0;
+static uint64_t vnow = 0;
+
+// Wall-clock time when virtual time started, and where it started
+static uint64_t utc_origin = 0;
+static uint64_t vstart = 0;
+
+static uint64_t read_clock(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+uint64_t now_ns(void)
+{
+    if (virtual) {
+        return vnow;
+    }
+
+    return read_clock(CLOCK_MONOTONIC);
+}
+
+uint64_t real_ns(void)
+{
+    return read_clock(CLOCK_MONOTONIC);
+}
+
+uint64_t utc_ns(void)
+{
+    if (virtual) {
+        return utc_origin + (vnow - vstart);
+    }
+
+    return read_clock(CLOCK_REALTIME);
+}
+
+void clock_use_virtual(uint64_t start)
+{
+    utc_origin = read_clock(CLOCK_REALTIME);
+    vstart = start;
+    vnow = start;
+    virtual = 1;
+}
+
+int clock_is_virtual(void)
+{
+    return virtual;
+}
+
+void clock_advance(uint64_t to)
+{
+    if (to > vnow) {
+        vnow = to;
+    }
+}
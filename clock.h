@@ -0,0 +1,59 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define NS_PER_MS 1000000ull
+#define NS_PER_SEC 1000000000ull
+
+/**
+ * The time everything that schedules work is measured against
+ * @return nanoseconds on CLOCK_MONOTONIC, or the virtual time
+ */
+uint64_t now_ns(void);
+
+/**
+ * Wall-clock time, for schedules given in UTC
+ * @return nanoseconds since the Unix epoch on CLOCK_REALTIME
+ */
+uint64_t utc_ns(void);
+
+/**
+ * Real time, whatever now_ns() is following
+ * @return nanoseconds on CLOCK_MONOTONIC
+ */
+uint64_t real_ns(void);
+
+/*
+ * Virtual time, for simulation
+ *
+ * Once switched on, now_ns() stands still until clock_advance() moves it,
+ * so the event loop jumps straight from one deadline to the next instead
+ * of sleeping through it. utc_ns() follows it from the wall-clock time
+ * when it was switched on.
+ */
+
+/**
+ * Switch now_ns() to virtual time
+ * @param start the virtual time to start at
+ */
+void clock_use_virtual(uint64_t start);
+
+/**
+ * Whether now_ns() is virtual
+ */
+int clock_is_virtual(void);
+
+/**
+ * Move virtual time forward, never back
+ * @param to the new time, from now_ns()
+ */
+void clock_advance(uint64_t to);
+
+#endif
@@ -11,9 +11,14 @@
 #include "lfr-tcp.h"
 #include "cmd_handler.h"
 #include "cmd_parser.h"
+#include "fec.h"
+#include "clock.h"
+#include "txsched.h"
 
 void cmd_nop() {
     log_info("NOP\n");
+    // The client is about to retry the TXDATA refused with EBUSY
+    cur_sess->tx_refused = 0;
     reply(CMD_NOP, 0, NULL);
 }
 
@@ -44,6 +49,35 @@ void cmd_tx_data(int len, uint8_t *data) {
     }
 }
 
+void cmd_tx_at(uint8_t clock, uint64_t when, int len, uint8_t *data) {
+    uint64_t due = when;
+    int err = 0;
+
+    if (clock == TX_AT_UTC) {
+        // Taken as the offset now; later steps of the wall clock are not
+        // followed
+        uint64_t offset = utc_ns() - now_ns();
+        due = when > offset ? when - offset : 0;
+    } else if (clock != TX_AT_MONOTONIC) {
+        err = -ECMDINVAL;
+    }
+
+    if (!err) {
+        err = txsched_add(cur_sess->port, due, data, len);
+        if (err == -2) {
+            err = -7; // -EBUSY from si446x
+        } else if (err < 0) {
+            err = -3; // -EINVAL from si446x
+        }
+    }
+
+    if (err) {
+        reply_error((uint8_t) -err);
+    } else {
+        reply(CMD_TX_AT, 0, NULL);
+    }
+}
+
 void cmd_set_freq(uint32_t freq) {
 
     log_info("SET_FREQ: %d Hz\n", freq);
@@ -58,26 +92,100 @@ void cmd_set_freq(uint32_t freq) {
 }
 
 void cmd_get_cfg() {
-    int err = -127; // ENOTIMPL
-
-    log_info("GET_CFG: Not implemented!\n");
+    struct kiss_params *params = &cur_sess->params;
+    uint8_t data[] = {CFG_VERSION,
+                      CFG_KISS_TXDELAY, params->txdelay,
+                      CFG_KISS_P, params->persist,
+                      CFG_KISS_SLOTTIME, params->slottime,
+                      CFG_KISS_TXTAIL, params->txtail,
+                      CFG_KISS_FULLDUPLEX, params->fullduplex,
+                      CFG_COMPRESS, cur_sess->link.compress,
+                      CFG_FEC, cur_sess->fec_depth,
+                      CFG_RX_BATCH, cur_sess->rx_batch,
+                      CFG_RX_HOLDOFF, cur_sess->rx_holdoff,
+                      CFG_ARQ, cur_sess->link.arq,
+                      CFG_AGGREGATE, cur_sess->link.agg_holdoff};
+
+    log_info("GET_CFG\n");
+
+    reply(CMD_GET_CFG, sizeof(data), data);
+}
 
-    if (err) {
-        reply_error((uint8_t) -err);
-    } else {
-        reply(CMD_GET_CFG, 0, NULL);
+/**
+ * Check one SET_CFG key/value pair without applying it
+ * @return 0 if valid, -ECMDINVAL if not
+ */
+static int cfg_check(uint8_t key, uint8_t value) {
+    switch (key) {
+        case CFG_KISS_TXDELAY:
+        case CFG_KISS_P:
+        case CFG_KISS_SLOTTIME:
+        case CFG_KISS_TXTAIL:
+        case CFG_KISS_FULLDUPLEX:
+        case CFG_RX_HOLDOFF:
+        case CFG_AGGREGATE:
+            return 0;
+        case CFG_COMPRESS:
+            return value > LINK_COMPRESS_ALWAYS ? -ECMDINVAL : 0;
+        case CFG_FEC:
+            return value > FEC_MAX_DEPTH ? -ECMDINVAL : 0;
+        case CFG_RX_BATCH:
+        case CFG_ARQ:
+            return value > 1 ? -ECMDINVAL : 0;
+        default:
+            return -ECMDINVAL;
     }
 }
 
 void cmd_set_cfg(int len, uint8_t *data) {
     int err = 0;
+    int i;
 
-    if (len == 0) {
+    if (len == 0 || data[0] != CFG_VERSION || len % 2 != 1) {
         err = -ECMDINVAL;
     } else {
         log_info("CFG_SET: ver %d\n", data[0]);
     }
-    
+
+    // All or nothing: a bad pair anywhere leaves every setting as it was
+    for (i = 1; !err && i < len; i += 2) {
+        err = cfg_check(data[i], data[i + 1]);
+    }
+
+    for (i = 1; !err && i < len; i += 2) {
+        switch (data[i]) {
+            case CFG_KISS_TXDELAY:
+            case CFG_KISS_P:
+            case CFG_KISS_SLOTTIME:
+            case CFG_KISS_TXTAIL:
+            case CFG_KISS_FULLDUPLEX:
+                err = kiss_set_param(data[i], data[i + 1]);
+                break;
+            case CFG_COMPRESS:
+                cur_sess->link.compress = data[i + 1];
+                break;
+            case CFG_FEC:
+                cur_sess->fec_depth = data[i + 1];
+                break;
+            case CFG_RX_BATCH:
+                cur_sess->rx_batch = data[i + 1];
+                break;
+            case CFG_RX_HOLDOFF:
+                cur_sess->rx_holdoff = data[i + 1];
+                break;
+            case CFG_ARQ:
+                if (data[i + 1] != cur_sess->link.arq) {
+                    // Start over from sequence number 0 either way
+                    arq_clear(&cur_sess->arq);
+                    arq_reset(&cur_sess->arq, cur_sess->port);
+                    cur_sess->link.arq = data[i + 1];
+                }
+                break;
+            case CFG_AGGREGATE:
+                cur_sess->link.agg_holdoff = data[i + 1];
+                break;
+        }
+    }
 
     if (err) {
         reply_error((uint8_t) -err);
@@ -87,10 +195,18 @@ void cmd_set_cfg(int len, uint8_t *data) {
 }
 
 void cmd_cfg_default() {
+    struct kiss_params params;
     int err = 0;
 
     log_info("CFG_DEFAULT\n");
 
+    kiss_params_default(&params);
+    err = kiss_set_param(CFG_KISS_TXDELAY, params.txdelay);
+    if (!err) err = kiss_set_param(CFG_KISS_P, params.persist);
+    if (!err) err = kiss_set_param(CFG_KISS_SLOTTIME, params.slottime);
+    if (!err) err = kiss_set_param(CFG_KISS_TXTAIL, params.txtail);
+    if (!err) err = kiss_set_param(CFG_KISS_FULLDUPLEX, params.fullduplex);
+
     if (err) {
         reply_error((uint8_t) -err);
     } else {
@@ -112,7 +228,7 @@ void cmd_save_cfg() {
 
 void cmd_get_queue_depth() {
     int err = 0;
-    uint16_t depth = 0;
+    uint16_t depth = txsched_stats(cur_sess->port)->pending;
     uint8_t data[] = {depth >> 8, depth & 0xFF};
 
     log_info("GET_QUEUE_DEPTH\n");
@@ -127,7 +243,8 @@ void cmd_get_queue_depth() {
 void cmd_abort_tx() {
     int err = 0;
 
-    log_info("ABORT_TX\n");
+    log_info("ABORT_TX: dropped %d scheduled frames\n",
+             txsched_cancel(cur_sess->port));
 
     if (err) {
         reply_error((uint8_t) -err);
@@ -136,6 +253,49 @@ void cmd_abort_tx() {
     }
 }
 
+static uint8_t *put_u32(uint8_t *p, uint64_t v) {
+    if (v > UINT32_MAX) {
+        v = UINT32_MAX;
+    }
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+void cmd_uptime() {
+    uint64_t now = now_ns();
+    uint8_t data[8];
+    int i;
+
+    log_info("UPTIME\n");
+
+    for (i = 0; i < 8; i++) {
+        data[i] = now >> (56 - 8 * i);
+    }
+
+    reply(CMD_UPTIME, sizeof(data), data);
+}
+
+void cmd_get_tx_stats() {
+    const struct txsched_stats *st = txsched_stats(cur_sess->port);
+    uint32_t timed = st->sent - st->past;
+    uint8_t data[24];
+    uint8_t *p = data;
+
+    log_info("GET_TX_STATS\n");
+
+    p = put_u32(p, st->sent);
+    p = put_u32(p, st->past);
+    p = put_u32(p, st->dropped);
+    p = put_u32(p, st->jitter_min);
+    p = put_u32(p, timed ? st->jitter_sum / timed : 0);
+    p = put_u32(p, st->jitter_max);
+
+    reply(CMD_GET_TX_STATS, sizeof(data), data);
+}
+
 void cmd_tx_psr() {
     int err = 0;
 
@@ -156,3 +316,12 @@ int reply_putc(uint8_t c) {
     uart_putc(c);
     return 0;
 }
+
+int reply_write(const uint8_t *buf, int len) {
+    uart_write(buf, len);
+    return 0;
+}
+
+int reply_unframed(uint8_t cmd, int len, const uint8_t *payload) {
+    return uart_reply(cmd, len, payload);
+}
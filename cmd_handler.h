@@ -9,12 +9,57 @@
 
 #include <stdint.h>
 
+/* Configuration format: a version byte, then (key, value) byte pairs */
+#define CFG_VERSION         1
+
+/* Keys for the KISS TNC parameters match the KISS command numbers */
+#define CFG_KISS_TXDELAY    0x01
+#define CFG_KISS_P          0x02
+#define CFG_KISS_SLOTTIME   0x03
+#define CFG_KISS_TXTAIL     0x04
+#define CFG_KISS_FULLDUPLEX 0x05
+
+/* Link compression mode, one of LINK_COMPRESS_* */
+#define CFG_COMPRESS        0x10
+
+/* Reed-Solomon interleaving depth, 0 for no FEC */
+#define CFG_FEC             0x11
+
+/* Coalesce received packets into CMD_RXDATA_BATCH replies (0 or 1), and
+ * how many ms to hold the first packet of a batch waiting for more */
+#define CFG_RX_BATCH        0x12
+#define CFG_RX_HOLDOFF      0x13
+
+/* Selective-repeat ARQ on the radio link (0 or 1), both ends must agree */
+#define CFG_ARQ             0x14
+
+/* Pack small frames into one radio frame, waiting up to this many 100 us
+ * units for more to arrive, 0 for off; the other end needs link framing */
+#define CFG_AGGREGATE       0x15
+
 /**
  * Send reply character
  * @param c the character to send
  */
 int reply_putc(uint8_t c);
 
+/**
+ * Send a complete reply frame
+ * @param buf the encoded frame
+ * @param len the length of the frame in bytes
+ */
+int reply_write(const uint8_t *buf, int len);
+
+/**
+ * Send a reply without LFR framing, if the client's transport allows it
+ * @param cmd the reply command byte
+ * @param len the payload length
+ * @param payload the payload
+ * @return 0 if sent, -1 if the reply must be framed and sent with
+ *         reply_write()
+ */
+int reply_unframed(uint8_t cmd, int len, const uint8_t *payload);
+
 /**
  * No-OPeration
  * Replies with success always
@@ -49,8 +94,21 @@ void cmd_set_txpwr(uint16_t pwr);
  */
 void cmd_tx_data(int len, uint8_t *data);
 
+/**
+ * Transmit the provided data at a set time
+ * Frames are held until their time, across client disconnects, and
+ * CMD_TX_ABORT drops them
+ * @param clock TX_AT_MONOTONIC or TX_AT_UTC
+ * @param when the time to transmit, in ns on that clock
+ * @param len the length of the data in bytes
+ * @param data pointer to the data
+ */
+void cmd_tx_at(uint8_t clock, uint64_t when, int len, uint8_t *data);
+
 /**
  * Set configuration
+ * Applies each (key, value) pair; KISS parameters are also sent to the TNC
+ * on the session's KISS port
  * @param len the length of the cfg data in bytes
  * @param data pointer to the cfg data
  */
@@ -58,7 +116,7 @@ void cmd_set_cfg(int len, uint8_t *data);
 
 /**
  * Get configuration
- * Returns the configuration data
+ * Returns the configuration data, every key with its current value
  */
 void cmd_get_cfg();
 
@@ -100,12 +158,27 @@ void cmd_tx_psr();
  */
 void cmd_rx_data();
 
+/**
+ * Get the bridge's clock
+ * Returns now_ns() as a 64-bit value, the time base of CMD_TX_AT with
+ * TX_AT_MONOTONIC; simulated time in a simulation
+ */
+void cmd_uptime();
+
 /**
  * Get the depth of the transmit queue
- * Returns the (16-bit) depth of the queue
+ * Returns the (16-bit) number of frames held by CMD_TX_AT
  */
 void cmd_get_queue_depth();
 
+/**
+ * Get scheduled transmit statistics
+ * Returns, as 32-bit values: frames sent, of those how many were already
+ * due when scheduled, frames dropped, and the minimum, mean and maximum
+ * time in ns between a frame's due time and its release to the link
+ */
+void cmd_get_tx_stats();
+
 /**
  * Send an error back
  * @param err the (positive) error code
@@ -8,6 +8,8 @@
 
 #include "cmd_parser.h"
 #include "cmd_handler.h"
+#include "lfr_frame.h"
+#include "trace.h"
 //#define USE_PRINTF
 #ifdef USE_PRINTF
 #include <stdio.h>
@@ -17,88 +19,64 @@ void command_handler(uint8_t cmd, uint8_t len, uint8_t* payload);
 
  bool validate_cmd(uint8_t cmd);
  bool validate_length(uint8_t cmd, uint8_t len);
- uint16_t fletcher(uint16_t old_checksum, uint8_t c);
 
 
-/**
- * enum for states of the byte parser state machine
- * Each state is named for the byte which the state machine expects to receive.
- */
-enum parser_state_e {S_SYNC0, S_SYNC1, S_CMD, S_PAYLOADLEN, S_PAYLOAD, S_CHECKSUM0, S_CHECKSUM1};
-
-/**
- * enum for the result of parsing a byte
- * The results can be:
- * wait for another character (take no action)
- * execute the command (if the byte completed a valid command)
- * invalid (the command was not valid, or the payload length was not valid for the command)
- * bad checksum (checksum mismatch)
- */
-enum parser_result_e {R_WAIT, R_ACT, R_INVALID, R_BADSUM};
-
-/* \fn parse_char(uint8_t c)
+/* \fn parse_char(struct cmd_parser *p, uint8_t c)
  * \brief Character-based command parser
  * \details Takes one character at a time, checks for validity, reports error or executes a completed command
+ * \param p The parser state for this command stream
  * \param c The next byte
  */
-void parse_char(uint8_t c) {
-  static enum parser_state_e next_state = S_SYNC0;
-  static enum parser_result_e result = R_WAIT;
-  static uint8_t cmd;
-  static uint8_t payload_len = 0, payload_counter = 0;
-  static uint8_t payload[MAX_PAYLOAD_LEN];
-  static uint16_t checksum;
-  static uint16_t calc_checksum;
-
+void parse_char(struct cmd_parser *p, uint8_t c) {
   /* step through the packet structure based on the latest character */
-  switch (next_state) {
+  switch (p->next_state) {
     case S_SYNC0:
-      if (SYNCWORD_H == c) next_state = S_SYNC1;
+      if (SYNCWORD_H == c) p->next_state = S_SYNC1;
       break;
     case S_SYNC1:
-      if (SYNCWORD_L == c) next_state = S_CMD;
+      if (SYNCWORD_L == c) p->next_state = S_CMD;
       /* for a sync word "Sy", "SSy" should be detected as valid */
-      else if (SYNCWORD_H != c)next_state = S_SYNC0;
+      else if (SYNCWORD_H != c)p->next_state = S_SYNC0;
       break;
     case S_CMD:
       if (validate_cmd(c)) {
-        cmd = c;
+        p->cmd = c;
         //calc_checksum = fletcher(calc_checksum, c);
-        calc_checksum = fletcher(0, c);
-        next_state = S_PAYLOADLEN;
+        p->calc_checksum = fletcher(0, c);
+        p->next_state = S_PAYLOADLEN;
       } else {
-        result = R_INVALID;
+        p->result = R_INVALID;
       }
       break;
     case S_PAYLOADLEN:
-      if (validate_length(cmd, c)) {
-        payload_len = c;
-        payload_counter = 0;
-        calc_checksum = fletcher(calc_checksum, c);
-        if (payload_len) {
-            next_state = S_PAYLOAD;
+      if (validate_length(p->cmd, c)) {
+        p->payload_len = c;
+        p->payload_counter = 0;
+        p->calc_checksum = fletcher(p->calc_checksum, c);
+        if (p->payload_len) {
+            p->next_state = S_PAYLOAD;
         } else {
-            next_state = S_CHECKSUM0;
+            p->next_state = S_CHECKSUM0;
         }
-      } else result = R_INVALID;
+      } else p->result = R_INVALID;
       break;
     case S_PAYLOAD:
-      payload[payload_counter] = c;
-      calc_checksum = fletcher(calc_checksum, c);
-      payload_counter++;
-      if (payload_counter == payload_len) {
-        next_state = S_CHECKSUM0;
+      p->payload[p->payload_counter] = c;
+      p->calc_checksum = fletcher(p->calc_checksum, c);
+      p->payload_counter++;
+      if (p->payload_counter == p->payload_len) {
+        p->next_state = S_CHECKSUM0;
       }
       break;
     case S_CHECKSUM0:
-      checksum = ((uint16_t) c) << 8;
-      next_state = S_CHECKSUM1;
+      p->checksum = ((uint16_t) c) << 8;
+      p->next_state = S_CHECKSUM1;
       break;
     case S_CHECKSUM1:
-      checksum = checksum | (uint16_t)c;
-      if (calc_checksum == checksum) {
-        result = R_ACT;
-      } else result = R_BADSUM;
+      p->checksum = p->checksum | (uint16_t)c;
+      if (p->calc_checksum == p->checksum) {
+        p->result = R_ACT;
+      } else p->result = R_BADSUM;
       break;
     default:
       //error();
@@ -106,30 +84,49 @@ void parse_char(uint8_t c) {
   }//switch(c)
 
   /* if that character created an error or concluded a valid packet, do something */
-  switch (result) {
+  switch (p->result) {
     case R_INVALID:
-      next_state = S_SYNC0;
-      result = R_WAIT;
+      p->next_state = S_SYNC0;
+      p->result = R_WAIT;
       cmd_err(ECMDINVAL);
       break;
     case R_BADSUM:
-      next_state = S_SYNC0;
-      result = R_WAIT;
+      p->next_state = S_SYNC0;
+      p->result = R_WAIT;
       cmd_err(ECMDBADSUM);
       break;
     case R_ACT:
-      next_state = S_SYNC0;
-      result = R_WAIT;
-      command_handler(cmd, payload_len, payload);
+      p->next_state = S_SYNC0;
+      p->result = R_WAIT;
+      trace_begin(TRACE_UART_READ);
+      trace_point(TRACE_PARSED);
+      command_handler(p->cmd, p->payload_len, p->payload);
+      trace_end();
     case R_WAIT:
       break;
   }
 }
+/* \fn parse_frame(uint8_t cmd, uint8_t len, uint8_t *payload)
+ * \brief Validate and execute an already framed command
+ */
+void parse_frame(uint8_t cmd, uint8_t len, uint8_t *payload) {
+  if (!validate_cmd(cmd) || !validate_length(cmd, len)) {
+    cmd_err(ECMDINVAL);
+    return;
+  }
+
+  trace_begin(TRACE_UART_READ);
+  trace_point(TRACE_PARSED);
+  command_handler(cmd, len, payload);
+  trace_end();
+}
+
 /* returns true for valid command types, false for invalid */
 bool validate_cmd(uint8_t cmd) {
   switch (cmd) {
     case CMD_NOP:
     case CMD_RESET:
+    case CMD_UPTIME:
     case CMD_READ_TXPWR:
     case CMD_SET_TXPWR:
     case CMD_TXDATA:
@@ -141,6 +138,8 @@ bool validate_cmd(uint8_t cmd) {
     case CMD_SAVE_CFG:
     case CMD_CFG_DEFAULT:
     case CMD_GET_QUEUE_DEPTH:
+    case CMD_TX_AT:
+    case CMD_GET_TX_STATS:
       return true;
     default:
       return false;
@@ -158,6 +157,8 @@ bool validate_length(uint8_t cmd, uint8_t len) {
       return len == 2;
     case CMD_TXDATA:
       return len > 0;
+    case CMD_TX_AT:
+      return len > TX_AT_HDR_LEN;
     case CMD_SET_FREQ:
       return len == 4;
     case CMD_SET_CFG:
@@ -167,17 +168,10 @@ bool validate_length(uint8_t cmd, uint8_t len) {
   }
 }
 
-/* update the mod-256 Fletcher checksum with the byte c */
-uint16_t fletcher(uint16_t old_checksum, uint8_t c) {
-  uint8_t lsb, msb;
-  lsb = old_checksum;
-  msb = (old_checksum >> 8) + c;
-  lsb += msb;
-  return ((uint16_t) msb<<8) | (uint16_t)lsb;
-}
-
 void command_handler(uint8_t cmd, uint8_t len, uint8_t* payload) {
 
+    trace_point(TRACE_DISPATCHED);
+
     switch (cmd) {
       case CMD_NOP:
         cmd_nop();
@@ -185,6 +179,9 @@ void command_handler(uint8_t cmd, uint8_t len, uint8_t* payload) {
       case CMD_RESET:
         cmd_reset();
         break;
+      case CMD_UPTIME:
+        cmd_uptime();
+        break;
       case CMD_READ_TXPWR:
         cmd_get_txpwr();
         break;
@@ -219,42 +216,52 @@ void command_handler(uint8_t cmd, uint8_t len, uint8_t* payload) {
       case CMD_GET_QUEUE_DEPTH:
           cmd_get_queue_depth();
           break;
+      case CMD_TX_AT: {
+          uint64_t when = 0;
+          int i;
+
+          for (i = 1; i < TX_AT_HDR_LEN; i++) {
+            when = when << 8 | payload[i];
+          }
+          cmd_tx_at(payload[0], when, len - TX_AT_HDR_LEN,
+                    &payload[TX_AT_HDR_LEN]);
+          break;
+      }
+      case CMD_GET_TX_STATS:
+          cmd_get_tx_stats();
+          break;
     }
 }
 
 void reply_error(uint8_t code)
 {
-    uint16_t chksum = 0;
-    reply_putc(SYNCWORD_H);
-    reply_putc(SYNCWORD_L);
-    reply_putc(CMD_REPLYERR);
-    chksum = fletcher(chksum, CMD_REPLYERR);
-    reply_putc(1);
-    chksum = fletcher(chksum, 1);
-    reply_putc(code);
-    chksum = fletcher(chksum, code);
-    reply_putc((char) (chksum >> 8));
-    reply_putc((char) chksum);
+    uint8_t frame[LFR_FRAME_OVERHEAD + 1];
+    int n;
+
+    if (reply_unframed(CMD_REPLYERR, 1, &code) == 0) {
+        return;
+    }
+
+    n = lfr_frame_encode(CMD_REPLYERR, 1, &code, frame);
+    reply_write(frame, n);
 }
 
 void reply(uint8_t cmd, int len, uint8_t *payload)
 {
-    uint16_t chksum = 0;
-    cmd ^= 0x80; // Flip highest bit in reply
-    reply_putc(SYNCWORD_H);
-    reply_putc(SYNCWORD_L);
-    reply_putc(cmd);
-    chksum = fletcher(chksum, cmd);
+    uint8_t frame[LFR_FRAME_MAX];
+    int n;
 
-    reply_putc(len);
-    chksum = fletcher(chksum, len);
+    cmd ^= 0x80; // Flip highest bit in reply
 
-    for (; len > 0; len--) {
-        reply_putc(*payload);
-        chksum = fletcher(chksum, *payload);
-        payload++;
+    if (reply_unframed(cmd, len, payload) == 0) {
+        trace_point(TRACE_UART_WRITTEN);
+        return;
     }
 
-    reply_putc((char) (chksum >> 8));
-    reply_putc((char) chksum);
+    n = lfr_frame_encode(cmd, len, payload, frame);
+    if (n > 0) {
+        trace_point(TRACE_REPLY_ENCODED);
+        reply_write(frame, n);
+        trace_point(TRACE_UART_WRITTEN);
+    }
 }
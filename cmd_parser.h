@@ -22,13 +22,20 @@
 /* System Group */
 #define CMD_NOP                 0x00
 #define CMD_RESET               0x01
-//#define CMD_UPTIME              0x02
+#define CMD_UPTIME              0x02 // monotonic time in ns, 8 bytes
 
 /* Data Group */
 #define CMD_TXDATA              0x10
 #define CMD_RXDATA              0x11
 #define CMD_TX_ABORT            0x12
 #define CMD_TX_PSR              0x13
+#define CMD_RXDATA_BATCH        0x14 // several received packets, [len][data]...
+#define CMD_TX_AT               0x15 // [clock][time, 8 bytes][data]
+
+/* CMD_TX_AT clocks; the time is in ns, big endian */
+#define TX_AT_MONOTONIC         0x00 // CLOCK_MONOTONIC of the bridge's host
+#define TX_AT_UTC               0x01 // since the Unix epoch
+#define TX_AT_HDR_LEN           9
 
 /* Configuration Group */
 #define CMD_GET_CFG             0x20
@@ -43,6 +50,7 @@
 //#define CMD_GET_STATUS          0x30
 //#define CMD_CLEAR_STATUS        0x31
 #define CMD_GET_QUEUE_DEPTH     0x32
+#define CMD_GET_TX_STATS        0x33
 
 /* Peripheral Group */
 //#define CMD_GPIO_WRITE          0x40
@@ -55,11 +63,50 @@
 #define CMD_REPLY               0x80
 
 
+/**
+ * enum for states of the byte parser state machine
+ * Each state is named for the byte which the state machine expects to receive.
+ */
+enum parser_state_e {S_SYNC0, S_SYNC1, S_CMD, S_PAYLOADLEN, S_PAYLOAD, S_CHECKSUM0, S_CHECKSUM1};
+
+/**
+ * enum for the result of parsing a byte
+ * The results can be:
+ * wait for another character (take no action)
+ * execute the command (if the byte completed a valid command)
+ * invalid (the command was not valid, or the payload length was not valid for the command)
+ * bad checksum (checksum mismatch)
+ */
+enum parser_result_e {R_WAIT, R_ACT, R_INVALID, R_BADSUM};
+
+/**
+ * State of one command stream's parser
+ * Zero-initialized is ready to receive a sync word.
+ */
+struct cmd_parser {
+  enum parser_state_e next_state;
+  enum parser_result_e result;
+  uint8_t cmd;
+  uint8_t payload_len, payload_counter;
+  uint8_t payload[MAX_PAYLOAD_LEN];
+  uint16_t checksum;
+  uint16_t calc_checksum;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void parse_char(uint8_t c);
+void parse_char(struct cmd_parser *p, uint8_t c);
+
+/**
+ * Handle a command from a transport that delivers whole commands, with no
+ * sync word or checksum
+ * @param cmd the command byte
+ * @param len the payload length
+ * @param payload the payload
+ */
+void parse_frame(uint8_t cmd, uint8_t len, uint8_t *payload);
 
 void reply_error(uint8_t code);
 void reply(uint8_t cmd, int len, uint8_t *payload);
@@ -1,64 +1,176 @@
 #!/usr/bin/env python3
 
+import os
 import sys
+import ctypes
 import socket
-from time import sleep
+import queue
+from collections import deque
+from concurrent.futures import Future
+from time import sleep, time
 import threading
 
-import socket
-
 from enum import Enum, auto
 
-SYNCWORD_H = 0xBE
-SYNCWORD_L = 0xEF
-
-class ParseState(Enum):
-    SYNC_H = 0
-    SYNC_L = 1
-    FLAGS = 2
-    CMD = 3
-    PAYLOAD_LEN = 4
-    PAYLOAD = 5
-    CHKSUM_H = 6
-    CHKSUM_L = 7
+LIBLFR_PATH = os.environ.get('LIBLFR', os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), 'liblfr.so'))
 
 class Command(Enum):
     NOP = 0x00
     RESET = 0x01
-    TXDATA = 0x02
-    GET_TXPWR = 0x03
-    SET_TXPWR = 0x04
-
-    RXDATA = 0x10
+    UPTIME = 0x02
+
+    TXDATA = 0x10
+    RXDATA = 0x11
+    TX_ABORT = 0x12
+    TX_PSR = 0x13
+    RXDATA_BATCH = 0x14
+    TX_AT = 0x15
+
+    GET_CFG = 0x20
+    SET_CFG = 0x21
+    SAVE_CFG = 0x22
+    CFG_DEFAULT = 0x23
+    SET_FREQ = 0x24
+    GET_TXPWR = 0x25
+    SET_TXPWR = 0x26
+
+    GET_QUEUE_DEPTH = 0x32
+    GET_TX_STATS = 0x33
 
     ERROR = 0x7F
 
     REPLY = 0x80
 
-def fletcher(chksum, byte):
-    lsb = chksum & 0xFF
-    msb = chksum >> 8
-    msb += byte
-    msb &= 0xFF
-    lsb += msb
-    lsb &= 0xFF
-    return (msb << 8) | lsb
+class LibLFR:
+    """ctypes binding for the framing and KISS codecs in liblfr.so"""
+
+    LFR_FRAME_OVERHEAD = 6
+    LFR_RECORD_HDR = 3
+    KISS_RECORD_HDR = 3
+
+    def __init__(self, path=LIBLFR_PATH):
+        lib = ctypes.CDLL(path)
+        buf = ctypes.c_char_p
+        c_int = ctypes.c_int
+
+        lib.fletcher_buf.argtypes = [ctypes.c_uint16, buf, c_int]
+        lib.fletcher_buf.restype = ctypes.c_uint16
+        lib.lfr_encode_batch.argtypes = [buf, c_int, buf, c_int]
+        lib.lfr_encode_batch.restype = c_int
+        lib.lfr_decoder_size.restype = c_int
+        lib.lfr_record_max.restype = c_int
+        lib.lfr_decoder_init.argtypes = [ctypes.c_void_p]
+        lib.lfr_decode.argtypes = [ctypes.c_void_p, buf, c_int, buf, c_int,
+                                   ctypes.POINTER(c_int)]
+        lib.lfr_decode.restype = c_int
+        lib.kiss_encode_batch.argtypes = [buf, c_int, buf, c_int]
+        lib.kiss_encode_batch.restype = c_int
+        lib.kiss_decoder_size.restype = c_int
+        lib.kiss_record_max.restype = c_int
+        lib.kiss_decoder_init.argtypes = [ctypes.c_void_p]
+        lib.kiss_decode.argtypes = [ctypes.c_void_p, buf, c_int, buf, c_int,
+                                    ctypes.POINTER(c_int)]
+        lib.kiss_decode.restype = c_int
+
+        self.lib = lib
+
+    def fletcher(self, data, chksum=0):
+        return self.lib.fletcher_buf(chksum, bytes(data), len(data))
+
+    def encode(self, frames):
+        """Encode a list of (cmd, payload) tuples into one byte string"""
+        recs = b''.join(bytes([cmd, len(pay)]) + bytes(pay)
+                        for (cmd, pay) in frames)
+        out = ctypes.create_string_buffer(
+            len(recs) + len(frames) * (self.LFR_FRAME_OVERHEAD - 2))
+        n = self.lib.lfr_encode_batch(recs, len(recs), out, len(out))
+        if n < 0:
+            raise ValueError('payload too long')
+        return out.raw[:n]
+
+    def kiss_encode(self, frames):
+        """KISS encode a list of (cmd, data) tuples into one byte string"""
+        recs = b''.join(bytes([cmd, len(data) >> 8, len(data) & 0xFF]) +
+                        bytes(data) for (cmd, data) in frames)
+        out = ctypes.create_string_buffer(2 * len(recs) + 4 * len(frames))
+        n = self.lib.kiss_encode_batch(recs, len(recs), out, len(out))
+        if n < 0:
+            raise ValueError('malformed frame')
+        return out.raw[:n]
+
+class _StreamDecoder:
+
+    def __init__(self, size, init, decode, hdr, record_max):
+        self.state = ctypes.create_string_buffer(size)
+        init(self.state)
+        self.decode = decode
+        self.hdr = hdr
+        self.record_max = record_max
+
+    def _records(self, data):
+        """Run the native decoder over data, yielding raw records"""
+        # Room for the largest record, so every call makes progress
+        out = ctypes.create_string_buffer(len(data) + self.record_max)
+        consumed = ctypes.c_int()
+
+        while data:
+            n = self.decode(self.state, data, len(data), out, len(out),
+                            ctypes.byref(consumed))
+            if n < 0:
+                raise RuntimeError('decoder output buffer too small')
+            rec = out.raw[:n]
+            i = 0
+            while i < n:
+                yield rec, i
+                i += self.hdr + self._len(rec, i)
+            data = data[consumed.value:]
+
+class FrameDecoder(_StreamDecoder):
+    """Incremental LFR frame decoder backed by liblfr"""
+
+    def __init__(self, lib):
+        super().__init__(lib.lib.lfr_decoder_size(),
+                         lib.lib.lfr_decoder_init, lib.lib.lfr_decode,
+                         LibLFR.LFR_RECORD_HDR, lib.lib.lfr_record_max())
+
+    def _len(self, rec, i):
+        return rec[i + 2]
+
+    def feed(self, data):
+        """Return a list of (status, cmd, payload) for each complete frame"""
+        return [(rec[i], rec[i + 1], rec[i + 3:i + 3 + rec[i + 2]])
+                for (rec, i) in self._records(data)]
+
+class KissDecoder(_StreamDecoder):
+    """Incremental KISS frame decoder backed by liblfr"""
+
+    def __init__(self, lib):
+        super().__init__(lib.lib.kiss_decoder_size(),
+                         lib.lib.kiss_decoder_init, lib.lib.kiss_decode,
+                         LibLFR.KISS_RECORD_HDR, lib.lib.kiss_record_max())
+
+    def _len(self, rec, i):
+        return (rec[i + 1] << 8) | rec[i + 2]
+
+    def feed(self, data):
+        """Return a list of (cmd, data) for each complete frame"""
+        return [(rec[i], rec[i + 3:i + 3 + self._len(rec, i)])
+                for (rec, i) in self._records(data)]
+
+_lib = None
+
+def liblfr():
+    global _lib
+    if _lib is None:
+        _lib = LibLFR()
+    return _lib
 
 def compute_chksum(data):
-    chksum = 0
-    for x in data:
-        chksum = fletcher(chksum, ord(x))
-    return chksum
+    return liblfr().fletcher(data)
 
 def create_tx_pkt(data):
-    pkt = '\x02'
-    pkt += chr(len(data))
-    pkt += data
-    chksum = compute_chksum(pkt)
-    pkt += chr(chksum >> 8)
-    pkt += chr(chksum & 0xFF)
-    pkt = '\xBE\xEF' + pkt
-    return pkt
+    return liblfr().encode([(Command.TXDATA.value, data)])
 
 class RadioException(Exception):
 
@@ -101,104 +213,322 @@ class RadioException(Exception):
 
     pass
 
+RXDATA_REPLY = Command.RXDATA.value | Command.REPLY.value
+RXDATA_BATCH_REPLY = Command.RXDATA_BATCH.value | Command.REPLY.value
+
+CFG_VERSION = 1
+CFG_RX_BATCH = 0x12
+CFG_RX_HOLDOFF = 0x13
+CFG_ARQ = 0x14
+CFG_AGGREGATE = 0x15
+
+def rx_packets(cmd, pay):
+    """The received packets in an RXDATA or RXDATA_BATCH reply, else None"""
+    if cmd == RXDATA_REPLY:
+        return [pay]
+    if cmd != RXDATA_BATCH_REPLY:
+        return None
+
+    pkts = []
+    i = 0
+    while i < len(pay):
+        n = pay[i]
+        pkts.append(pay[i + 1:i + 1 + n])
+        i += 1 + n
+    return pkts
+
+TX_AT_MONOTONIC = 0
+TX_AT_UTC = 1
+
+def tx_at_payload(when_ns, data, clock=TX_AT_MONOTONIC):
+    """TX_AT payload sending data at when_ns, from time.monotonic_ns() for
+    TX_AT_MONOTONIC or time.time_ns() for TX_AT_UTC"""
+    return bytes([clock]) + when_ns.to_bytes(8, 'big') + bytes(data)
+
+def tx_stats(pay):
+    """Decode a GET_TX_STATS reply; jitter is in ns"""
+    keys = ('sent', 'past', 'dropped', 'jitter_min', 'jitter_mean',
+            'jitter_max')
+    return {k: int.from_bytes(pay[4 * i:4 * i + 4], 'big')
+            for (i, k) in enumerate(keys)}
+
+def rx_batch_cfg(holdoff_ms=0):
+    """SET_CFG payload turning on batched RX, holding packets up to holdoff_ms"""
+    return bytes([CFG_VERSION, CFG_RX_BATCH, 1, CFG_RX_HOLDOFF, holdoff_ms])
+
+def aggregate_cfg(holdoff_us):
+    """SET_CFG payload packing small frames into one radio frame, waiting up
+    to holdoff_us for more"""
+    return bytes([CFG_VERSION, CFG_AGGREGATE, (holdoff_us + 99) // 100])
+
 class Radio:
 
     def __init__(self, host, port=2600):
         self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         self.sock.connect((host, port))
-        self.state = ParseState.SYNC_H
+        self.decoder = FrameDecoder(liblfr())
+        self.frames = deque()
+        self.rx_frames = deque()
 
     def tx(self, data):
-        pkt = chr(Command.TXDATA.value)
-        pkt += chr(len(data))
-        pkt += data
-        chksum = compute_chksum(pkt)
-        pkt += chr(chksum >> 8)
-        pkt += chr(chksum & 0xFF)
-        pkt = '\xBE\xEF' + pkt
-
-        self.sock.sendall(bytes([ord(x) for x in pkt]))
-
-        (flags, cmd, pay) = self.recv()
-
-        if cmd  == Command.ERROR.value | Command.REPLY.value:
-            err = RadioException(ord(pay[0]))
-            if err.error == 'EBUSY':
-                self.tx(data)
+        while True:
+            self.sock.sendall(create_tx_pkt(data))
+
+            (cmd, pay) = self.recv_reply()
+
+            if cmd == Command.ERROR.value:
+                err = RadioException(pay[0])
+                if err.error != 'EBUSY':
+                    raise err
+                self.nop()
+
+            elif cmd == Command.TXDATA.value | Command.REPLY.value:
+                return
             else:
-                raise err
+                raise Exception('Unexpected response: ' + str((cmd, pay)))
 
-        elif Command.TXDATA.value | Command.REPLY.value:
-            return
-        else:
-            raise Exception('Unexpected response: ' + str((flags, cmd, pay)))
+    def nop(self):
+        """Send a NOP; after an EBUSY, the bridge refuses every TXDATA
+        until one arrives"""
+        self.sock.sendall(liblfr().encode([(Command.NOP.value, b'')]))
+
+        (cmd, pay) = self.recv_reply()
+
+        if cmd == Command.ERROR.value:
+            raise RadioException(pay[0])
+        elif cmd != Command.NOP.value | Command.REPLY.value:
+            raise Exception('Unexpected response: ' + str((cmd, pay)))
 
     def rx(self):
-        (flags, cmd, pay) = self.recv()
+        if self.rx_frames:
+            return self.rx_frames.popleft()
 
-        if cmd  == Command.ERROR.value | Command.REPLY.value:
+        (cmd, pay) = self.recv()
+
+        pkts = rx_packets(cmd, pay)
+        if cmd == Command.ERROR.value:
             raise RadioException(pay[0])
-        elif Command.RXDATA.value | Command.REPLY.value:
-            return pay
+        elif pkts is not None:
+            self.rx_frames.extend(pkts[1:])
+            return pkts[0]
         else:
-            raise Exception('Unexpected response: ' + str((flags, cmd, pay)))
+            raise Exception('Unexpected response: ' + str((cmd, pay)))
+
+    def recv_reply(self):
+        """Receive the next reply, setting aside any RXDATA that arrives first"""
+        while True:
+            (cmd, pay) = self.recv()
+            pkts = rx_packets(cmd, pay)
+            if pkts is None:
+                return (cmd, pay)
+            self.rx_frames.extend(pkts)
 
     def recv(self):
 
-        payload = ''
+        while not self.frames:
+            data = self.sock.recv(4096)
+            if not data:
+                raise ConnectionError('radio closed the connection')
+
+            for (status, cmd, pay) in self.decoder.feed(data):
+                # TODO: Handle checksum errors
+                if status == 0:
+                    self.frames.append((cmd, pay))
+
+        return self.frames.popleft()
+
+class PipelinedRadio:
+    """
+    Radio client that keeps up to `window` commands outstanding.
+
+    lfr-tcp answers commands strictly in order, so replies are matched to
+    the oldest outstanding command. A background reader thread sorts
+    replies from unsolicited RXDATA: received packets go to `on_rx` if
+    given, otherwise to a queue read with rx().
+
+    Commands return a concurrent.futures.Future; use add_done_callback()
+    for callbacks, or asyncio.wrap_future() to await them.
+
+    A command refused with EBUSY is retried without failing its Future.
+    New commands are held back until every command in flight has been
+    answered. The bridge refuses every TXDATA sent behind a refused one,
+    so none can overtake it. Once everything is answered, a NOP lifts
+    that, and the refused commands and the held ones are sent again in
+    their original order. This happens after a backoff that starts at
+    `busy_backoff` seconds and doubles while the bridge stays busy. Against a bridge on
+    virtual time (-V), pass busy_backoff=0: it already holds a refused
+    client back until time moves, and a real-time sleep would let
+    simulated time run on meanwhile.
+    """
+
+    BUSY_BACKOFF_MIN = 0.005
+    BUSY_BACKOFF_MAX = 0.5
+
+    def __init__(self, host, port=2600, window=8, on_rx=None,
+                 busy_backoff=BUSY_BACKOFF_MIN):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.connect((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.decoder = FrameDecoder(liblfr())
+        self.window = threading.BoundedSemaphore(window)
+        self.lock = threading.Lock()
+        self.pending = deque()
+        self.refused = deque()
+        self.held = deque()
+        self.stalled = False
+        self.busy_backoff = busy_backoff
+        self.backoff = busy_backoff
+        self.rx_queue = queue.Queue()
+        self.on_rx = on_rx
+        self.closed = False
+        self.reader = threading.Thread(target=self._read_loop, daemon=True)
+        self.reader.start()
+
+    def command(self, cmd, payload=b''):
+        """Send a command, blocking only while the window is full"""
+        fut = Future()
+        self.window.acquire()
+        if self.closed:
+            self.window.release()
+            raise ConnectionError('radio connection closed')
+        self._send((cmd, bytes(payload), fut))
+        return fut
 
-        while True:
-            c = self.sock.recv(1)[0]
-
-            if self.state is ParseState.SYNC_H:
-                if c == SYNCWORD_H:
-                    self.state = ParseState.SYNC_L
-            elif self.state is ParseState.SYNC_L:
-                if c == SYNCWORD_L:
-                    self.state = ParseState.FLAGS
-                elif c == SYNCWORD_H:
-                    self.state = ParseState.SYNC_L
-                else:
-                    self.state = ParseState.SYNC_H
-            elif self.state is ParseState.FLAGS:
-                flags = c
-                self.state = ParseState.CMD
-            elif self.state is ParseState.CMD:
-                cmd = c
-                self.state = ParseState.PAYLOAD_LEN
-            elif self.state is ParseState.PAYLOAD_LEN:
-                length = c
-                # TODO: Validate len for cmd
-                if (length):
-                    self.state = ParseState.PAYLOAD
-                else:
-                    chksum = compute_chksum(''.join([chr(flags), chr(cmd), chr(0)]))
-                    self.state = ParseState.CHKSUM_H
-
-            elif self.state is ParseState.PAYLOAD:
-                payload += chr(c)
-                length -= 1
-                self.state = ParseState.PAYLOAD
-                if (length == 0):
-                    chksum = compute_chksum(''.join([chr(flags), chr(cmd), chr(len(payload))]) + payload)
-                    self.state = ParseState.CHKSUM_H
-            elif self.state is ParseState.CHKSUM_H:
-                if (c == chksum >> 8):
-                    self.state = ParseState.CHKSUM_L
-                else:
-                    # TODO: Handle error
-                    pass
-                    self.state = ParseState.SYNC_H
+    def tx(self, data):
+        return self.command(Command.TXDATA.value, data)
+
+    def tx_at(self, when_ns, data, clock=TX_AT_MONOTONIC):
+        return self.command(Command.TX_AT.value,
+                            tx_at_payload(when_ns, data, clock))
+
+    def uptime(self):
+        """The bridge's clock in ns, the time base of tx_at(); simulated
+        time when the bridge runs with -V"""
+        return int.from_bytes(self.command(Command.UPTIME.value).result(),
+                              'big')
+
+    def rx(self, timeout=None):
+        """Return the next received packet (only when on_rx is not set)"""
+        return self.rx_queue.get(timeout=timeout)
+
+    def flush(self):
+        """Wait until every outstanding command has been answered"""
+        with self.lock:
+            futs = [fut for (_, _, fut) in
+                    list(self.pending) + list(self.refused) + list(self.held)
+                    if fut is not None]
+        for fut in futs:
+            fut.exception()
+
+    def close(self):
+        self.sock.shutdown(socket.SHUT_RDWR)
+        self.reader.join()
+        self.sock.close()
+
+    def _write(self, entry):
+        """Send a command; call with the lock held"""
+        self.pending.append(entry)
+        self.sock.sendall(create_tx_pkt(entry[1]) if
+                          entry[0] == Command.TXDATA.value else
+                          liblfr().encode([(entry[0], entry[1])]))
+
+    def _send(self, entry):
+        with self.lock:
+            if self.stalled:
+                self.held.append(entry)
+            else:
+                self._write(entry)
+
+    def _resume(self):
+        """Send the refused and held commands again, in order"""
+        with self.lock:
+            if self.closed:
+                return
+            entries = list(self.refused) + list(self.held)
+            self.refused.clear()
+            self.held.clear()
+            self.stalled = False
+            try:
+                # Lets the bridge take TXDATA again; answered internally
+                self._write((Command.NOP.value, b'', None))
+                for entry in entries:
+                    self._write(entry)
+            except OSError:
+                pass
+
+    def _stall_done(self):
+        """Once nothing is in flight, wait out the backoff; call with the
+        lock held"""
+        if self.stalled and not self.pending:
+            timer = threading.Timer(self.backoff, self._resume)
+            timer.daemon = True
+            timer.start()
+            self.backoff = min(2 * self.backoff, self.BUSY_BACKOFF_MAX)
+
+    def _complete(self, cmd, pay):
+        with self.lock:
+            if not self.pending:
+                return
+            entry = self.pending.popleft()
+
+            # Keep the window slot and send it again, still in order
+            if (cmd == Command.ERROR.value and
+                    RadioException(pay[0]).error == 'EBUSY'):
+                self.stalled = True
+                self.refused.append(entry)
+                self._stall_done()
+                return
+
+            if not self.stalled:
+                self.backoff = self.busy_backoff
+            self._stall_done()
+
+        fut = entry[2]
+        if fut is None:
+            return
+        if cmd == Command.ERROR.value:
+            fut.set_exception(RadioException(pay[0]))
+        elif cmd == entry[0] | Command.REPLY.value:
+            fut.set_result(pay)
+        else:
+            fut.set_exception(Exception('Unexpected response: ' +
+                                        str((cmd, pay))))
+        self.window.release()
+
+    def _read_loop(self):
+        try:
+            while True:
+                data = self.sock.recv(65536)
+                if not data:
                     break
-            elif self.state is ParseState.CHKSUM_L:
-                if (c != chksum & 0xFF):
-                    # TODO: Handle error
-                    pass
-                self.state = ParseState.SYNC_H
-                break
 
-
-        return (flags, cmd, payload)
+                for (status, cmd, pay) in self.decoder.feed(data):
+                    if status != 0:
+                        continue
+                    pkts = rx_packets(cmd, pay)
+                    if pkts is not None:
+                        for pkt in pkts:
+                            if self.on_rx:
+                                self.on_rx(pkt)
+                            else:
+                                self.rx_queue.put(pkt)
+                    else:
+                        self._complete(cmd, pay)
+        except OSError:
+            pass
+        finally:
+            self.closed = True
+            with self.lock:
+                pending = (list(self.pending) + list(self.refused) +
+                           list(self.held))
+                self.pending.clear()
+                self.refused.clear()
+                self.held.clear()
+            for (_, _, fut) in pending:
+                if fut is None:
+                    continue
+                fut.set_exception(ConnectionError('radio connection closed'))
+                self.window.release()
 
 
 def main():
@@ -216,14 +546,28 @@ def main():
         radio = Radio(sys.argv[1], int(sys.argv[2]))
         sleep(1)
         for i in range(int(sys.argv[4])):
-            data = ('KC2QOL ' + str(i + 1) + ' ').ljust(104, 'x')
+            data = ('KC2QOL ' + str(i + 1) + ' ').ljust(104, 'x').encode()
             print('TX>', data)
             radio.tx(data)
             print('Sent ' + str(len(data)) + ' byte(s)')
             # Look ma, no sleep!
 
+    elif (len(sys.argv) == 6 and sys.argv[3] == 'tx'):
+        radio = PipelinedRadio(sys.argv[1], int(sys.argv[2]),
+                               window=int(sys.argv[5]))
+        n = int(sys.argv[4])
+        start = time()
+        for i in range(n):
+            data = ('KC2QOL ' + str(i + 1) + ' ').ljust(104, 'x').encode()
+            radio.tx(data)
+        radio.flush()
+        elapsed = time() - start
+        print('Sent {} packet(s) in {:.3f} s ({:.0f} packet/s)'.format(
+            n, elapsed, n / elapsed))
+        radio.close()
+
     else:
-        print('Usage: python3', sys.argv[0], 'hostname port [rx | tx n]')
+        print('Usage: python3', sys.argv[0], 'hostname port [rx | tx n [window]]')
 
 
 if __name__ == '__main__':
@@ -0,0 +1,119 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fec.h"
+
+int fec_encode(int depth, const uint8_t *in, int len, uint8_t *out)
+{
+    uint8_t cw[RS_N];
+    uint8_t *data, *parity;
+    int m = len + 2;
+    int k, c, i;
+
+    if (depth < 1) {
+        depth = 1;
+    }
+    while (depth <= FEC_MAX_DEPTH && (m + depth - 1) / depth > RS_MAX_K) {
+        depth++;
+    }
+    if (depth > FEC_MAX_DEPTH) {
+        return -1;
+    }
+
+    k = (m + depth - 1) / depth;
+
+    for (i = 0; i < FEC_HDR_COPIES; i++) {
+        out[i] = depth;
+    }
+
+    // The message is already interleaved: length, frame, zero padding
+    data = &out[FEC_HDR_COPIES];
+    parity = &data[k * depth];
+    data[0] = len >> 8;
+    data[1] = len & 0xFF;
+    memcpy(&data[2], in, len);
+    memset(&data[m], 0, k * depth - m);
+
+    for (c = 0; c < depth; c++) {
+        uint8_t par[RS_NPAR];
+
+        for (i = 0; i < k; i++) {
+            cw[i] = data[i * depth + c];
+        }
+
+        rs_encode(cw, k, par);
+
+        for (i = 0; i < RS_NPAR; i++) {
+            parity[i * depth + c] = par[i];
+        }
+    }
+
+    return FEC_HDR_COPIES + depth * (k + RS_NPAR);
+}
+
+int fec_decode(uint8_t *in, int len, uint8_t *out, int out_len,
+               uint32_t *corrected)
+{
+    uint8_t cw[RS_N];
+    uint8_t *data;
+    int depth, n, k, c, i;
+    int m;
+
+    if (len < FEC_HDR_COPIES) {
+        return -1;
+    }
+
+    // Bitwise majority of the three header copies
+    depth = (in[0] & in[1]) | (in[0] & in[2]) | (in[1] & in[2]);
+    if (depth < 1 || depth > FEC_MAX_DEPTH) {
+        return -1;
+    }
+
+    len -= FEC_HDR_COPIES;
+    if (len % depth) {
+        return -1;
+    }
+
+    n = len / depth;
+    k = n - RS_NPAR;
+    if (k < 1 || k > RS_MAX_K) {
+        return -1;
+    }
+
+    data = &in[FEC_HDR_COPIES];
+
+    for (c = 0; c < depth; c++) {
+        int fixed;
+
+        for (i = 0; i < n; i++) {
+            cw[i] = data[i * depth + c];
+        }
+
+        fixed = rs_decode(cw, n);
+        if (fixed < 0) {
+            return -1;
+        }
+
+        if (fixed) {
+            *corrected += fixed;
+            for (i = 0; i < k; i++) {
+                data[i * depth + c] = cw[i];
+            }
+        }
+    }
+
+    m = (data[0] << 8) | data[1];
+    if (m > k * depth - 2 || m > out_len) {
+        return -1;
+    }
+
+    // out may be the input buffer
+    memmove(out, &data[2], m);
+    return m;
+}
@@ -0,0 +1,54 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+#include "rs.h"
+
+/*
+ * Forward error correction for KISS data frames
+ *
+ * A frame is prefixed with its 16-bit length and split across `depth`
+ * RS(255,223) codewords, byte i going to codeword i % depth, so a burst of
+ * errors on the air is spread over several codewords. On the wire the
+ * codewords are sent interleaved the same way: all data symbols, then all
+ * parity symbols. The depth is sent ahead of them in FEC_HDR_COPIES
+ * copies, decoded by bitwise majority vote.
+ */
+
+#define FEC_MAX_DEPTH 8
+#define FEC_HDR_COPIES 3
+
+/* Largest encoded frame */
+#define FEC_MAX_FRAME (FEC_HDR_COPIES + FEC_MAX_DEPTH * RS_N)
+
+/**
+ * Encode a frame
+ * The depth is raised if the frame does not fit in depth codewords.
+ * @param depth the interleaving depth (1 to FEC_MAX_DEPTH)
+ * @param in the frame
+ * @param len the length of the frame
+ * @param out destination, must hold FEC_MAX_FRAME bytes
+ * @return the encoded length, or -1 if the frame is too long
+ */
+int fec_encode(int depth, const uint8_t *in, int len, uint8_t *out);
+
+/**
+ * Decode a frame, correcting errors
+ * @param in the received frame, modified in place
+ * @param len the length of the received frame
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @param corrected incremented by the number of symbols corrected
+ * @return the decoded length, or -1 if the frame could not be recovered
+ */
+int fec_decode(uint8_t *in, int len, uint8_t *out, int out_len,
+               uint32_t *corrected);
+
+#endif
@@ -0,0 +1,225 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "handoff.h"
+
+/* fd number the new process finds its handoff socket on */
+#define HANDOFF_CHILD_FD 3
+
+int handoff_spawn(char **argv, pid_t *pid)
+{
+    int sv[2];
+    pid_t child;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return -1;
+    }
+
+    child = fork();
+    if (child < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (child == 0) {
+        char fdstr[16];
+
+        // The sockets arrive over the handoff socket; inherited copies
+        // would keep connections open after the new process closes them
+        if (sv[1] == HANDOFF_CHILD_FD) {
+            fcntl(sv[1], F_SETFD, 0);
+        } else if (dup2(sv[1], HANDOFF_CHILD_FD) < 0) {
+            _exit(127);
+        }
+        close_range(HANDOFF_CHILD_FD + 1, ~0U, 0);
+
+        snprintf(fdstr, sizeof(fdstr), "%d", HANDOFF_CHILD_FD);
+        setenv(HANDOFF_ENV, fdstr, 1);
+
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    *pid = child;
+    return sv[0];
+}
+
+int handoff_inherited(void)
+{
+    char *s = getenv(HANDOFF_ENV);
+    int fd;
+
+    if (!s) {
+        return -1;
+    }
+
+    fd = atoi(s);
+    // Not for any process we exec later
+    unsetenv(HANDOFF_ENV);
+
+    return fd;
+}
+
+static int write_all(int sock, const uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int n = write(sock, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int read_all(int sock, uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int n = read(sock, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int handoff_send(int sock, const int *fds, int nfds, const uint8_t *buf,
+                 int len)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint32_t hdr = len;
+
+    if (nfds < 1 || nfds > HANDOFF_MAX_FDS) {
+        return -1;
+    }
+
+    // The sockets ride on the length word, the state follows as a stream
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    if (sendmsg(sock, &msg, 0) != sizeof(hdr)) {
+        return -1;
+    }
+
+    return write_all(sock, buf, len);
+}
+
+int handoff_recv(int sock, int *fds, int *nfds, uint8_t *buf, int len)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint32_t hdr;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(hdr)) {
+        return -1;
+    }
+
+    *nfds = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+        }
+    }
+
+    if (*nfds == 0 || (msg.msg_flags & MSG_CTRUNC) || hdr > (uint32_t) len) {
+        return -1;
+    }
+
+    if (read_all(sock, buf, hdr) < 0) {
+        return -1;
+    }
+
+    return hdr;
+}
+
+int handoff_ack(int sock)
+{
+    uint8_t ok = 1;
+
+    return write_all(sock, &ok, 1);
+}
+
+int handoff_wait(int sock, int timeout_ms)
+{
+    struct pollfd pfd;
+    uint8_t ok;
+    int n;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return -1;
+    }
+
+    // EOF means the new process gave up
+    if (read(sock, &ok, 1) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
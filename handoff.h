@@ -0,0 +1,82 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Socket handoff between an old and a newly exec'd lfr-tcp
+ *
+ * The old process spawns the new binary with one end of a Unix socket
+ * pair, named in the environment. It sends its open sockets (SCM_RIGHTS)
+ * and a state blob, and the new process answers with a single byte once it
+ * is serving.
+ */
+
+/* Environment variable naming the handoff socket in the new process */
+#define HANDOFF_ENV "LFR_HANDOFF_FD"
+
+/* Most sockets passed in one handoff */
+#define HANDOFF_MAX_FDS 128
+
+/**
+ * Exec a new copy of the program with a handoff socket
+ * The child keeps only stdio and its end of the socket pair.
+ * @param argv the argument vector to exec, argv[0] is looked up in PATH
+ * @param pid set to the process id of the child
+ * @return our end of the handoff socket, or -1 on error
+ */
+int handoff_spawn(char **argv, pid_t *pid);
+
+/**
+ * The handoff socket passed in by an old process
+ * @return the socket, or -1 if this is a fresh start
+ */
+int handoff_inherited(void);
+
+/**
+ * Send sockets and state to the new process
+ * @param sock the handoff socket
+ * @param fds the sockets to pass
+ * @param nfds the number of sockets, at most HANDOFF_MAX_FDS
+ * @param buf the state blob
+ * @param len the length of the state blob
+ * @return 0 on success, -1 on error
+ */
+int handoff_send(int sock, const int *fds, int nfds, const uint8_t *buf,
+                 int len);
+
+/**
+ * Receive sockets and state from the old process
+ * @param sock the handoff socket
+ * @param fds destination for the sockets, HANDOFF_MAX_FDS entries
+ * @param nfds set to the number of sockets received
+ * @param buf destination for the state blob
+ * @param len size of the destination buffer
+ * @return the length of the state blob, or -1 on error
+ */
+int handoff_recv(int sock, int *fds, int *nfds, uint8_t *buf, int len);
+
+/**
+ * Tell the old process that we are serving
+ * @param sock the handoff socket
+ * @return 0 on success, -1 on error
+ */
+int handoff_ack(int sock);
+
+/**
+ * Wait for the new process to start serving
+ * @param sock the handoff socket
+ * @param timeout_ms how long to wait
+ * @return 0 once acknowledged, -1 on error, timeout or if the new process
+ *         gave up
+ */
+int handoff_wait(int sock, int timeout_ms);
+
+#endif
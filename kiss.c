@@ -0,0 +1,154 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kiss.h"
+
+int kiss_encode(uint8_t cmd, const uint8_t *buf, int len, uint8_t *out)
+{
+    int i;
+    int n = 0;
+
+    out[n++] = KISS_FEND;
+    out[n++] = cmd;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == KISS_FEND) {
+            out[n++] = KISS_FESC;
+            out[n++] = KISS_TFEND;
+        } else if (buf[i] == KISS_FESC) {
+            out[n++] = KISS_FESC;
+            out[n++] = KISS_TFESC;
+        } else {
+            out[n++] = buf[i];
+        }
+    }
+
+    out[n++] = KISS_FEND;
+
+    return n;
+}
+
+int kiss_unescape(const uint8_t *in, int len, uint8_t *out, int out_len)
+{
+    int i, j;
+
+    j = 0;
+    for (i = 0; i < len; i++) {
+        if (j == out_len) {
+            return -2;
+        }
+
+        if (in[i] == KISS_FESC) {
+            i++;
+            if (i < len && in[i] == KISS_TFEND) {
+                out[j++] = KISS_FEND;
+            } else if (i < len && in[i] == KISS_TFESC) {
+                out[j++] = KISS_FESC;
+            } else {
+                return -1;
+            }
+        } else {
+            out[j++] = in[i];
+        }
+    }
+
+    return j;
+}
+
+int kiss_encode_batch(const uint8_t *in, int in_len, uint8_t *out, int out_len)
+{
+    int i = 0;
+    int n = 0;
+
+    while (i < in_len) {
+        int len;
+
+        if (in_len - i < KISS_RECORD_HDR) {
+            return -1;
+        }
+
+        len = (in[i + 1] << 8) | in[i + 2];
+        if (in_len - i - KISS_RECORD_HDR < len ||
+            out_len - n < KISS_ENCODED_MAX(len)) {
+            return -1;
+        }
+
+        n += kiss_encode(in[i], &in[i + KISS_RECORD_HDR], len, &out[n]);
+        i += len + KISS_RECORD_HDR;
+    }
+
+    return n;
+}
+
+int kiss_decoder_size(void)
+{
+    return sizeof(struct kiss_decoder);
+}
+
+int kiss_record_max(void)
+{
+    return KISS_RECORD_HDR + KISS_BUF_SIZE;
+}
+
+void kiss_decoder_init(struct kiss_decoder *d)
+{
+    memset(d, 0, sizeof(*d));
+}
+
+int kiss_decode(struct kiss_decoder *d, const uint8_t *in, int in_len,
+                uint8_t *out, int out_len, int *consumed)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < in_len; i++) {
+        if (in[i] != KISS_FEND) {
+            if (d->len == KISS_BUF_SIZE) {
+                d->overflow = 1;
+            } else {
+                d->buf[d->len++] = in[i];
+            }
+            continue;
+        }
+
+        // Empty frame (back to back FENDs) is allowed, ignore
+        if (d->len == 0) {
+            continue;
+        }
+
+        if (!d->overflow) {
+            int len;
+
+            // Unescaping never grows the frame, so this bounds the record
+            if (out_len - n < KISS_RECORD_HDR + d->len - 1) {
+                *consumed = i;
+                return n ? n : -1;
+            }
+
+            len = kiss_unescape(&d->buf[1], d->len - 1,
+                                &out[n + KISS_RECORD_HDR], d->len - 1);
+            if (len < 0) {
+                d->bad_frames++;
+            } else {
+                out[n] = d->buf[0];
+                out[n + 1] = len >> 8;
+                out[n + 2] = len & 0xFF;
+                n += KISS_RECORD_HDR + len;
+            }
+        } else {
+            d->bad_frames++;
+        }
+
+        d->len = 0;
+        d->overflow = 0;
+    }
+
+    *consumed = in_len;
+    return n;
+}
@@ -0,0 +1,121 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef KISS_H
+#define KISS_H
+
+#include <stdint.h>
+
+/* Largest escaped frame we reassemble; big enough for FEC-coded frames */
+#define KISS_BUF_SIZE 4096
+
+#define KISS_FEND 0xC0
+#define KISS_FESC 0xDB
+#define KISS_TFEND 0xDC
+#define KISS_TFESC 0xDD
+
+/* KISS command bytes: port number in the high nibble, command in the low */
+#define KISS_MAX_PORTS 16
+#define KISS_CMD(port, cmd) ((uint8_t) (((port) << 4) | (cmd)))
+#define KISS_PORT(c) ((c) >> 4)
+#define KISS_TYPE(c) ((c) & 0x0F)
+
+#define KISS_CMD_DATA       0x00
+#define KISS_CMD_TXDELAY    0x01
+#define KISS_CMD_P          0x02
+#define KISS_CMD_SLOTTIME   0x03
+#define KISS_CMD_TXTAIL     0x04
+#define KISS_CMD_FULLDUPLEX 0x05
+#define KISS_CMD_SETHW      0x06
+#define KISS_CMD_RETURN     0xFF
+
+/* Worst case encoded size: every byte escaped, plus FEND, cmd and FEND */
+#define KISS_ENCODED_MAX(len) (2 * (len) + 4)
+
+/* Size of the per-frame header in the records used by the batch APIs */
+#define KISS_RECORD_HDR 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Streaming KISS frame decoder
+ * Collects escaped bytes between FENDs so frames may span several buffers
+ */
+struct kiss_decoder {
+    int len;
+    int overflow;
+    uint32_t bad_frames;
+    uint8_t buf[KISS_BUF_SIZE];
+};
+
+/**
+ * Encode one KISS frame, escaping FEND and FESC
+ * @param cmd the KISS command byte
+ * @param buf the frame data
+ * @param len the length of the frame data in bytes
+ * @param out destination, must hold KISS_ENCODED_MAX(len) bytes
+ * @return the number of bytes written
+ */
+int kiss_encode(uint8_t cmd, const uint8_t *buf, int len, uint8_t *out);
+
+/**
+ * Undo KISS escaping on the body of a frame (without FENDs)
+ * @param in the escaped bytes
+ * @param len the number of escaped bytes
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @return the decoded length, -1 on an invalid transpose or -2 if too long
+ */
+int kiss_unescape(const uint8_t *in, int len, uint8_t *out, int out_len);
+
+/**
+ * Encode a batch of KISS frames
+ * The input is a sequence of [cmd][len_h][len_l][data] records.
+ * @return the number of bytes written, or -1 on malformed input or overflow
+ */
+int kiss_encode_batch(const uint8_t *in, int in_len, uint8_t *out, int out_len);
+
+/**
+ * Size of struct kiss_decoder, for callers that allocate it themselves
+ */
+int kiss_decoder_size(void);
+
+/**
+ * Largest record kiss_decode() writes; an out buffer this big always
+ * has room for the next one
+ */
+int kiss_record_max(void);
+
+/**
+ * Reset a decoder to an empty frame
+ */
+void kiss_decoder_init(struct kiss_decoder *d);
+
+/**
+ * Decode a buffer of received bytes
+ * Every complete, non-empty frame is written to out as a
+ * [cmd][len_h][len_l][data] record. Malformed frames are counted in
+ * bad_frames and dropped. Decoding stops early if the next record would
+ * not fit; an out buffer of kiss_record_max() bytes always has room.
+ * @param d the decoder state
+ * @param in the received bytes
+ * @param in_len the number of received bytes
+ * @param out destination buffer for records
+ * @param out_len size of the destination buffer
+ * @param consumed set to the number of input bytes consumed
+ * @return the number of bytes of records written, -1 if the next record
+ *         would not fit in out_len and none was written
+ */
+int kiss_decode(struct kiss_decoder *d, const uint8_t *in, int in_len,
+                uint8_t *out, int out_len, int *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
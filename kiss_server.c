@@ -0,0 +1,422 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "lfr-tcp.h"
+#include "kiss_server.h"
+#include "trace.h"
+
+struct kiss_client {
+    int fd;             // -1 for a free slot
+    struct kiss_decoder dec;
+    struct outbuf out;
+    uint8_t out_mem[KISS_OUT_SIZE];
+};
+
+/* A client as handed off, followed by its queued bytes */
+struct client_state {
+    struct kiss_decoder dec;
+    int out_len;
+};
+
+static int listenfd = -1;
+
+// Slots keep their place, so a client closed mid-pass is simply skipped
+static struct kiss_client clients[KISS_SERVER_MAX_CLIENTS];
+static int num_clients = 0;
+
+// Logged once each time frames start going nowhere
+static int dropping = 0;
+static uint32_t lost = 0;
+
+static uint8_t export_buf[KISS_SERVER_STATE_MAX];
+
+static void clients_init(void)
+{
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+    num_clients = 0;
+}
+
+/* Bytes the client's TCP has not acknowledged, queued or in the kernel */
+static int client_unacked(const struct kiss_client *c)
+{
+    int unacked = 0;
+
+    if (ioctl(c->fd, SIOCOUTQ, &unacked) < 0) {
+        unacked = 0;
+    }
+
+    return outbuf_pending(&c->out) + unacked;
+}
+
+static void client_close(struct kiss_client *c)
+{
+    if (client_unacked(c) > 0) {
+        lost++;
+    }
+
+    close(c->fd);
+    c->fd = -1;
+    num_clients--;
+}
+
+int kiss_server_open(char *host, int port)
+{
+    clients_init();
+
+    listenfd = open_server(host, port);
+    if (listenfd < 0) {
+        return -1;
+    }
+
+    if (listen(listenfd, KISS_SERVER_MAX_CLIENTS) < 0) {
+        log_err("ERROR listening: %s\n", strerror(errno));
+        close(listenfd);
+        listenfd = -1;
+        return -1;
+    }
+
+    log_info("Serving KISS on port %d\n", port);
+    return 0;
+}
+
+int kiss_server_clients(void)
+{
+    return num_clients;
+}
+
+int kiss_server_write(const uint8_t *buf, int len)
+{
+    int fits = 0;
+    int i;
+
+    if (num_clients == 0) {
+        if (!dropping) {
+            log_info("No KISS clients, dropping frames until one connects\n");
+            dropping = 1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && outbuf_space(&clients[i].out) >= len) {
+            fits = 1;
+        }
+    }
+    if (!fits) {
+        return -2;
+    }
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        struct kiss_client *c = &clients[i];
+        int err;
+
+        if (c->fd < 0) {
+            continue;
+        }
+
+        err = outbuf_write(&c->out, c->fd, buf, len);
+        if (err == -2) {
+            log_err("KISS client %d not keeping up, disconnecting it\n", i);
+            client_close(c);
+        } else if (err < 0) {
+            log_err("ERROR writing to KISS client %d: %s\n", i,
+                    strerror(errno));
+            client_close(c);
+        }
+    }
+
+    return 0;
+}
+
+int kiss_server_pending(void)
+{
+    int pending = -1;
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 &&
+            (pending < 0 || outbuf_pending(&clients[i].out) < pending)) {
+            pending = outbuf_pending(&clients[i].out);
+        }
+    }
+
+    return pending < 0 ? 0 : pending;
+}
+
+uint64_t kiss_server_unacked(void)
+{
+    uint64_t unacked = 0;
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 &&
+            (uint64_t) client_unacked(&clients[i]) > unacked) {
+            unacked = client_unacked(&clients[i]);
+        }
+    }
+
+    return unacked;
+}
+
+uint32_t kiss_server_lost(void)
+{
+    return lost;
+}
+
+int kiss_server_fds(fd_set *read_fds, fd_set *write_fds)
+{
+    int maxfd = listenfd;
+    int i;
+
+    FD_SET(listenfd, read_fds);
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        struct kiss_client *c = &clients[i];
+
+        if (c->fd < 0) {
+            continue;
+        }
+
+        FD_SET(c->fd, read_fds);
+        if (outbuf_pending(&c->out)) {
+            FD_SET(c->fd, write_fds);
+        }
+        if (c->fd > maxfd) {
+            maxfd = c->fd;
+        }
+    }
+
+    return maxfd;
+}
+
+static void client_accept(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int enable = 1;
+    int fd;
+    int i;
+
+    fd = accept4(listenfd, (struct sockaddr *) &addr, &addr_len,
+                 SOCK_NONBLOCK);
+    if (fd < 0) {
+        log_err("ERROR accepting KISS client: %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            break;
+        }
+    }
+    if (i == KISS_SERVER_MAX_CLIENTS) {
+        log_err("ERROR already serving %d KISS clients, refusing %s\n",
+                num_clients, inet_ntoa(addr.sin_addr));
+        close(fd);
+        return;
+    }
+
+    // Frames are written whole; don't hold the tail of one back
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable,
+                   sizeof(enable)) < 0) {
+        log_err("ERROR setting KISS socket options: %s\n", strerror(errno));
+    }
+
+    clients[i].fd = fd;
+    kiss_decoder_init(&clients[i].dec);
+    outbuf_init(&clients[i].out, clients[i].out_mem, KISS_OUT_SIZE);
+    num_clients++;
+    dropping = 0;
+
+    log_info("New KISS client %d from %s\n", i, inet_ntoa(addr.sin_addr));
+}
+
+/* One read per pass, like an LFR session */
+static void client_read(int i, kiss_server_handler handler)
+{
+    struct kiss_client *c = &clients[i];
+    static uint8_t recs[KISS_RECORD_HDR + 2 * KISS_BUF_SIZE];
+    uint8_t buf[KISS_BUF_SIZE];
+    uint32_t bad = c->dec.bad_frames;
+    int off = 0;
+    int n;
+
+    n = read(c->fd, buf, sizeof(buf));
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        log_err("ERROR reading from KISS client %d: %s\n", i,
+                strerror(errno));
+        client_close(c);
+        return;
+    }
+
+    if (n == 0) {
+        log_info("KISS client %d closed\n", i);
+        client_close(c);
+        return;
+    }
+
+    trace_read(TRACE_KISS_READ);
+    while (off < n) {
+        int used;
+        int len;
+        int pos = 0;
+
+        len = kiss_decode(&c->dec, &buf[off], n - off, recs, sizeof(recs),
+                          &used);
+        off += used;
+
+        while (pos < len) {
+            int flen = (recs[pos + 1] << 8) | recs[pos + 2];
+
+            handler(recs[pos], &recs[pos + KISS_RECORD_HDR], flen);
+            pos += KISS_RECORD_HDR + flen;
+        }
+
+        // Sending in reply may have dropped this client
+        if (c->fd < 0) {
+            return;
+        }
+    }
+
+    if (c->dec.bad_frames != bad) {
+        log_err("ERROR receiving KISS from client %d: %u bad frames\n", i,
+                c->dec.bad_frames - bad);
+    }
+}
+
+void kiss_server_poll(fd_set *read_fds, fd_set *write_fds,
+                      kiss_server_handler handler)
+{
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        struct kiss_client *c = &clients[i];
+
+        if (c->fd >= 0 && FD_ISSET(c->fd, write_fds) &&
+            outbuf_flush(&c->out, c->fd) < 0) {
+            log_err("ERROR writing to KISS client %d: %s\n", i,
+                    strerror(errno));
+            client_close(c);
+        }
+
+        if (c->fd >= 0 && FD_ISSET(c->fd, read_fds)) {
+            client_read(i, handler);
+        }
+    }
+
+    // Last, so a new client can't take a slot whose fd is still in the sets
+    if (FD_ISSET(listenfd, read_fds)) {
+        client_accept();
+    }
+}
+
+void kiss_server_flush(void)
+{
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            outbuf_flush(&clients[i].out, clients[i].fd);
+        }
+    }
+}
+
+int kiss_server_export_fds(int *fds)
+{
+    int n = 0;
+    int i;
+
+    fds[n++] = listenfd;
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            fds[n++] = clients[i].fd;
+        }
+    }
+
+    return n;
+}
+
+const void *kiss_server_export(int *len)
+{
+    int pos = 0;
+    int i;
+
+    for (i = 0; i < KISS_SERVER_MAX_CLIENTS; i++) {
+        struct kiss_client *c = &clients[i];
+        struct client_state st;
+
+        if (c->fd < 0) {
+            continue;
+        }
+
+        st.dec = c->dec;
+        st.out_len = outbuf_pending(&c->out);
+        memcpy(&export_buf[pos], &st, sizeof(st));
+        pos += sizeof(st);
+        pos += outbuf_peek(&c->out, &export_buf[pos]);
+    }
+
+    *len = pos;
+    return export_buf;
+}
+
+int kiss_server_import(const int *fds, int nfds, const void *buf, int len)
+{
+    const uint8_t *p = buf;
+    int pos = 0;
+    int i;
+
+    if (nfds < 1 || nfds - 1 > KISS_SERVER_MAX_CLIENTS) {
+        return -1;
+    }
+
+    clients_init();
+    listenfd = fds[0];
+
+    for (i = 0; i < nfds - 1; i++) {
+        struct kiss_client *c = &clients[i];
+        struct client_state st;
+
+        if (len - pos < (int) sizeof(st)) {
+            return -1;
+        }
+        memcpy(&st, &p[pos], sizeof(st));
+        pos += sizeof(st);
+
+        c->fd = fds[i + 1];
+        c->dec = st.dec;
+        outbuf_init(&c->out, c->out_mem, KISS_OUT_SIZE);
+        if (st.out_len < 0 || len - pos < st.out_len ||
+            outbuf_queue(&c->out, &p[pos], st.out_len) < 0) {
+            return -1;
+        }
+        pos += st.out_len;
+        num_clients++;
+    }
+
+    return pos == len ? 0 : -1;
+}
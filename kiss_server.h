@@ -0,0 +1,126 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef KISS_SERVER_H
+#define KISS_SERVER_H
+
+#include <stdint.h>
+#include <sys/select.h>
+
+#include "kiss.h"
+#include "lfr-tcp.h"
+
+/*
+ * KISS over TCP with lfr-tcp as the TNC
+ *
+ * Ground software connects to a listening socket, several clients at a
+ * time. Every frame is sent to every client, each through its own output
+ * queue, and frames from any client are received as if from one TNC
+ * link. Clients come and go without affecting the LFR side: while none
+ * is connected, frames for the link are dropped. A client whose queue
+ * cannot take a frame that another client's can is disconnected, so one
+ * stalled client never holds up the rest.
+ */
+
+#define KISS_SERVER_MAX_CLIENTS 8
+
+/* Upper bound on the size of kiss_server_export() */
+#define KISS_SERVER_STATE_MAX (KISS_SERVER_MAX_CLIENTS * \
+        (sizeof(struct kiss_decoder) + KISS_OUT_SIZE + 16) + 16)
+
+/**
+ * Called for each received frame
+ * @param cmd the KISS command byte
+ * @param data the frame, unescaped, may be modified
+ * @param len the length of the frame
+ */
+typedef int (*kiss_server_handler)(uint8_t cmd, uint8_t *data, int len);
+
+/**
+ * Start listening for KISS clients
+ * @param host the address to listen on, NULL for all
+ * @param port the port
+ * @return 0 on success, -1 on error
+ */
+int kiss_server_open(char *host, int port);
+
+/**
+ * Number of clients connected
+ */
+int kiss_server_clients(void);
+
+/**
+ * Queue an encoded KISS frame for every client
+ * Clients whose queue cannot take it are disconnected, unless none can.
+ * @param buf the encoded frame
+ * @param len the length of the frame
+ * @return 0 on success, including when no client is connected, -2 if no
+ *         client has room for the frame (nothing is written)
+ */
+int kiss_server_write(const uint8_t *buf, int len);
+
+/**
+ * Bytes queued for the client that is furthest ahead, 0 with no clients
+ */
+int kiss_server_pending(void);
+
+/**
+ * Bytes written to the clients that the furthest behind has not yet
+ * acknowledged at the TCP level, including what is still queued
+ */
+uint64_t kiss_server_unacked(void);
+
+/**
+ * Number of clients ever disconnected with frames not acknowledged
+ * Frames sent before one of these may not have reached any client.
+ */
+uint32_t kiss_server_lost(void);
+
+/**
+ * Add the listening socket and clients to the select() sets
+ * @return the highest fd added
+ */
+int kiss_server_fds(fd_set *read_fds, fd_set *write_fds);
+
+/**
+ * Accept clients, send queued frames and receive frames
+ * @param read_fds the readable set from select()
+ * @param write_fds the writable set from select()
+ * @param handler called for each received frame
+ */
+void kiss_server_poll(fd_set *read_fds, fd_set *write_fds,
+                      kiss_server_handler handler);
+
+/**
+ * Write as much queued data as the clients will take, before an upgrade
+ */
+void kiss_server_flush(void);
+
+/**
+ * The listening socket and then the clients, for handing off
+ * @param fds filled with 1 + kiss_server_clients() sockets
+ * @return the number of sockets
+ */
+int kiss_server_export_fds(int *fds);
+
+/**
+ * The clients' queues and partly received frames, for handing off
+ * @param len set to the size of the state
+ * @return the state
+ */
+const void *kiss_server_export(int *len);
+
+/**
+ * Take over the sockets and state of another process's server
+ * @param fds the sockets from kiss_server_export_fds()
+ * @param nfds the number of sockets
+ * @param buf the state from kiss_server_export()
+ * @param len its size
+ * @return 0 on success, -1 if the state does not match
+ */
+int kiss_server_import(const int *fds, int nfds, const void *buf, int len);
+
+#endif
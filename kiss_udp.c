@@ -0,0 +1,204 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lfr-tcp.h"
+#include "kiss_udp.h"
+
+struct udp_slot {
+    int len;
+    uint8_t data[KISS_UDP_FRAME_MAX];
+};
+
+static struct sockaddr_in dest;
+
+// Outgoing frames, a ring so a partial send keeps them in order
+static struct udp_slot tx_q[KISS_UDP_BATCH];
+static int tx_head;
+static int tx_count;
+
+static struct udp_slot rx_q[KISS_UDP_BATCH];
+
+int kiss_udp_open(char *host, int port, int local_port)
+{
+    struct sockaddr_in local;
+    int enable = 1;
+    int fd;
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &dest.sin_addr) <= 0) {
+        log_err("ERROR Invalid address: %s\n", host);
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        log_err("Error opening socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Several consumers on one host may share a multicast port
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+        log_err("ERROR setting socket options: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(local_port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0) {
+        log_err("ERROR binding: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (IN_MULTICAST(ntohl(dest.sin_addr.s_addr))) {
+        struct ip_mreq mreq;
+
+        mreq.imr_multiaddr = dest.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                       sizeof(mreq)) < 0) {
+            log_err("ERROR joining multicast group %s: %s\n", host,
+                    strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+int kiss_udp_pending(void)
+{
+    return tx_count;
+}
+
+int kiss_udp_flush(int fd)
+{
+    struct mmsghdr msgs[KISS_UDP_BATCH];
+    struct iovec iov[KISS_UDP_BATCH];
+    int n;
+    int i;
+
+    while (tx_count) {
+        for (i = 0; i < tx_count; i++) {
+            struct udp_slot *s = &tx_q[(tx_head + i) % KISS_UDP_BATCH];
+
+            iov[i].iov_base = s->data;
+            iov[i].iov_len = s->len;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &dest;
+            msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        n = sendmmsg(fd, msgs, tx_count, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        tx_head = (tx_head + n) % KISS_UDP_BATCH;
+        tx_count -= n;
+    }
+
+    if (tx_count == 0) {
+        tx_head = 0;
+    }
+
+    return 0;
+}
+
+int kiss_udp_queue(int fd, uint8_t cmd, const uint8_t *buf, int len)
+{
+    struct udp_slot *s;
+
+    if (len + 1 > KISS_UDP_FRAME_MAX) {
+        return -1;
+    }
+
+    if (tx_count == KISS_UDP_BATCH) {
+        if (kiss_udp_flush(fd) < 0) {
+            return -1;
+        }
+        if (tx_count == KISS_UDP_BATCH) {
+            return -2;
+        }
+    }
+
+    s = &tx_q[(tx_head + tx_count) % KISS_UDP_BATCH];
+    s->data[0] = cmd;
+    memcpy(&s->data[1], buf, len);
+    s->len = len + 1;
+    tx_count++;
+
+    return 0;
+}
+
+int kiss_udp_recv(int fd, kiss_udp_handler handler)
+{
+    struct mmsghdr msgs[KISS_UDP_BATCH];
+    struct iovec iov[KISS_UDP_BATCH];
+    int n;
+    int i;
+
+    for (i = 0; i < KISS_UDP_BATCH; i++) {
+        iov[i].iov_base = rx_q[i].data;
+        iov[i].iov_len = KISS_UDP_FRAME_MAX;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // One batch per pass, like the UART side
+    n = recvmmsg(fd, msgs, KISS_UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        int len = msgs[i].msg_len;
+
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            log_err("ERROR receiving KISS: Packet too long\n");
+            continue;
+        }
+
+        // Empty datagram is allowed, ignore
+        if (len == 0) {
+            continue;
+        }
+
+        handler(rx_q[i].data[0], &rx_q[i].data[1], len - 1);
+    }
+
+    return n;
+}
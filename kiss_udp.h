@@ -0,0 +1,77 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef KISS_UDP_H
+#define KISS_UDP_H
+
+#include <stdint.h>
+
+#include "fec.h"
+
+/*
+ * KISS over UDP
+ *
+ * One frame per datagram: the KISS command byte followed by the frame,
+ * with no FEND delimiters and no escaping. Frames are queued and sent in
+ * batches with sendmmsg(), and received in batches with recvmmsg().
+ */
+
+/* Datagrams moved per syscall */
+#define KISS_UDP_BATCH 64
+
+/* Command byte plus the largest wire frame */
+#define KISS_UDP_FRAME_MAX (1 + FEC_MAX_FRAME)
+
+/**
+ * Called for each received frame
+ * @param cmd the KISS command byte
+ * @param data the frame, may be modified
+ * @param len the length of the frame
+ */
+typedef int (*kiss_udp_handler)(uint8_t cmd, uint8_t *data, int len);
+
+/**
+ * Open the UDP socket
+ * Joins the group if host is a multicast address.
+ * @param host where frames are sent (unicast or multicast IPv4)
+ * @param port the destination port
+ * @param local_port the port frames are received on
+ * @return the socket, or -1 on error
+ */
+int kiss_udp_open(char *host, int port, int local_port);
+
+/**
+ * Queue a frame, sending the batch first if it is full
+ * @param fd the UDP socket
+ * @param cmd the KISS command byte
+ * @param buf the frame
+ * @param len the length of the frame
+ * @return 0 on success, -1 if the frame is too long or on a socket error,
+ *         -2 if the socket is backed up and the queue is full
+ */
+int kiss_udp_queue(int fd, uint8_t cmd, const uint8_t *buf, int len);
+
+/**
+ * Number of frames waiting to be sent
+ */
+int kiss_udp_pending(void);
+
+/**
+ * Send as many queued frames as the socket will take
+ * @param fd the UDP socket
+ * @return 0 on success, -1 on a socket error
+ */
+int kiss_udp_flush(int fd);
+
+/**
+ * Drain the socket, calling handler for each datagram
+ * @param fd the UDP socket
+ * @param handler called for each frame
+ * @return the number of frames received, or -1 on a socket error
+ */
+int kiss_udp_recv(int fd, kiss_udp_handler handler);
+
+#endif
@@ -11,21 +11,171 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/types.h> 
+#include <sys/wait.h>
+#include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "lfr-tcp.h"
 #include "cmd_parser.h"
+#include "trace.h"
+#include "lzss.h"
+#include "fec.h"
+#include "handoff.h"
+#include "clock.h"
+#include "channel.h"
+#include "kiss_udp.h"
+#include "ax25.h"
+#include "timer.h"
+#include "txsched.h"
+#include "spool.h"
+#include "kiss_server.h"
 
 int kissfd = -1;
-int uartfd = -1;
+
+static uint8_t kiss_out_mem[KISS_OUT_SIZE];
+static struct outbuf kiss_out;
+static int kiss_throttled = 0;
+
+// KISS frame being reassembled
+static uint8_t kiss_buf[KISS_BUF_SIZE];
+static int kiss_buf_len = 0;
+
+static struct session sessions[KISS_MAX_PORTS];
+static int num_ports = 1;
+struct session *cur_sess = NULL;
+
+// SAT and GND clients talk through the in-memory channel, no KISS TNC
+static int loopback = 0;
+
+// Loopback on virtual time: real microseconds of quiet before it jumps
+static int sim_idle_us = 0;
+
+// Real time the loop has been busy since it last went quiet, 0 if it hasn't
+static uint64_t sim_busy_since = 0;
+
+// KISS frames are UDP datagrams rather than a byte stream
+static int udp_kiss = 0;
+
+// Ground software connects to us, as to a TNC, rather than we to it
+static int kiss_listen = 0;
+
+// Unix socket shared-memory clients connect to
+static int shm_listenfd = -1;
 
 uint8_t sys_stat = 0;
 uint16_t tx_gate_bias;
 
+static volatile sig_atomic_t trace_dump_req = 0;
+static volatile sig_atomic_t upgrade_req = 0;
+static volatile sig_atomic_t filter_reload_req = 0;
+
+static void handle_sigusr1(int sig)
+{
+    trace_dump_req = 1;
+}
+
+static void handle_sigusr2(int sig)
+{
+    upgrade_req = 1;
+}
+
+static void handle_sighup(int sig)
+{
+    filter_reload_req = 1;
+}
+
+// Callsign filter for received frames. A reload fills the spare table and
+// swaps it in, so a bad file leaves the old one in place.
+static struct ax25_filter rx_filters[2];
+static struct ax25_filter *rx_filter = &rx_filters[0];
+static char *filter_path = NULL;
+static uint32_t rx_filtered = 0;
+
+// Bytes ever queued for the KISS socket
+static uint64_t kiss_bytes = 0;
+
+/* Spool read positions and the KISS byte count that covers them, waiting
+ * for the TNC to acknowledge that many bytes */
+#define SPOOL_MARKS 64
+
+/* How often to look for acknowledgements while marks are waiting */
+#define SPOOL_COMMIT_NS (100 * NS_PER_MS)
+
+struct spool_mark {
+    struct spool_pos pos;
+    uint64_t bytes;
+};
+
+static struct spool_mark spool_marks[SPOOL_MARKS];
+static int spool_marks_head = 0;
+static int spool_marks_len = 0;
+
+// Spooled frames sent since the last mark, maybe still in an aggregate
+static int spool_unmarked = 0;
+
+// KISS clients lost with frames in flight, as last seen by the spool
+static uint32_t spool_lost_seen = 0;
+
+/* Upgrade state layout, bump UPGRADE_VERSION when it changes */
+#define UPGRADE_MAGIC 0x4C465255 // "LFRU"
+#define UPGRADE_VERSION 10
+
+/* How long the old process waits for the new one to start serving */
+#define UPGRADE_TIMEOUT_MS 5000
+
+struct upgrade_hdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t sess_size;
+    int num_ports;
+    int kiss_throttled;
+    int kiss_buf_len;
+    int kiss_out_len;
+    int kiss_fds;
+    int kiss_server_len;
+    int has_shm_listener;
+    int arq_pool_len;
+    int txsched_len;
+    struct spool_pos spool_pos;
+    uint64_t kiss_bytes;
+};
+
+struct upgrade_sess {
+    int has_fd;
+    int has_shm;
+    struct cmd_parser parser;
+    struct kiss_params params;
+    struct link_state link;
+    uint8_t fec_depth;
+    uint8_t rx_batch;
+    uint8_t rx_holdoff;
+    struct arq_state arq;
+    int agg_len;
+    int agg_count;
+    uint8_t agg[LINK_MAX_FRAME];
+    int throttled;
+    int tx_refused;
+    int in_len;
+    int out_len;
+};
+
+#define UPGRADE_STATE_MAX (sizeof(struct upgrade_hdr) + \
+        KISS_MAX_PORTS * (sizeof(struct upgrade_sess) + KISS_BUF_SIZE + \
+                          UART_OUT_SIZE) + \
+        ARQ_POOL_STATE_MAX + TXSCHED_STATE_MAX + KISS_SERVER_STATE_MAX + \
+        KISS_BUF_SIZE + KISS_OUT_SIZE)
+
+static uint8_t upgrade_buf[UPGRADE_STATE_MAX];
+
 void log_err(const char *fmt, ...)
 {
         va_list args;
@@ -79,114 +229,576 @@ void log_data(char *s, uint8_t *data, int len)
     }
 }
 
-void uart_putc(char c)
+static int uart_fd(void)
 {
-    int n; 
-    
-    if (uartfd < 0)
+    if (!cur_sess || cur_sess->fd < 0)
     {
         log_err("ERROR UART socket not connected!\n");
-        return;
+        return -1;
     }
-    
-    n = write(uartfd, &c, 1);
 
-    if (n < 0)
-    {
-        log_err("ERROR writing to socket: %s\n", strerror(errno));
-    }
+    return cur_sess->fd;
+}
+
+void uart_putc(char c)
+{
+    uart_write((uint8_t *) &c, 1);
 }
 
 void uart_puts(char *s)
 {
-    int n; 
+    uart_write((uint8_t *) s, strlen(s));
+}
+
+void uart_write(const uint8_t *buf, int len)
+{
+    int err;
+    int fd = uart_fd();
 
-    if (uartfd < 0)
+    if (fd < 0)
     {
-        log_err("ERROR UART socket not connected!\n");
         return;
     }
 
-    n = write(uartfd, s, strlen(s));
+    err = outbuf_write(&cur_sess->out, fd, buf, len);
 
-    if (n < 0)
+    // Replies can't get here: commands wait for room (session_parse())
+    if (err == -2)
+    {
+        log_err("ERROR UART client not keeping up, dropping %d bytes\n", len);
+    }
+    else if (err < 0)
     {
         log_err("ERROR writing to socket: %s\n", strerror(errno));
     }
 }
 
-int kiss_putc(char c)
+int uart_reply(uint8_t cmd, int len, const uint8_t *payload)
 {
-    int n; 
-    
-    if (kissfd < 0)
+    struct shm_conn *c;
+
+    if (!cur_sess || cur_sess->shm.sock < 0) {
+        return -1;
+    }
+
+    // Replies can't get here: commands wait for room (shm_reply_room())
+    c = &cur_sess->shm;
+    if (lfr_shm_push(&c->shm->reply, cmd, len, payload) < 0) {
+        log_err("ERROR shared memory client not keeping up, dropping reply\n");
+        return 0;
+    }
+    lfr_shm_notify(&c->shm->reply, c->reply_efd);
+
+    return 0;
+}
+
+/**
+ * Bytes waiting for the KISS side, held against the flow control marks
+ */
+static int kiss_backlog(void)
+{
+    if (kiss_listen) {
+        return kiss_server_pending();
+    }
+
+    return outbuf_pending(&kiss_out);
+}
+
+int kiss_write(const uint8_t *buf, int len)
+{
+    int err;
+
+    if (kiss_listen)
+    {
+        err = kiss_server_write(buf, len);
+    }
+    else if (kissfd < 0)
     {
         log_err("ERROR KISS socket not connected!\n");
         return -1;
     }
-    
-    n = write(kissfd, &c, 1);
+    else
+    {
+        err = outbuf_write(&kiss_out, kissfd, buf, len);
+    }
+    if (err >= 0) {
+        kiss_bytes += len;
+    }
 
-    if (n < 0)
+    if (err == -2)
+    {
+        return -2;
+    }
+    else if (err < 0)
     {
         log_err("ERROR writing to socket: %s\n", strerror(errno));
         return -1;
     }
 
+    if (!kiss_throttled && kiss_backlog() > KISS_OUT_HIGH_WATER)
+    {
+        log_info("KISS backlog at %d bytes, pausing LFR clients\n",
+                 kiss_backlog());
+        kiss_throttled = 1;
+    }
+
     return 0;
 }
 
-int kiss_send_async(int len, uint8_t *buf)
+/**
+ * Send one KISS frame on whichever transport is in use
+ * @return 0 on success, -1 on error, -2 if the transport is backed up
+ */
+static int kiss_send_frame(uint8_t cmd, const uint8_t *buf, int len)
+{
+    uint8_t frame[KISS_ENCODED_MAX(FEC_MAX_FRAME)];
+    int n;
+    int err;
+
+    if (udp_kiss) {
+        err = kiss_udp_queue(kissfd, cmd, buf, len);
+        if (err == -1) {
+            log_err("ERROR writing to socket: %s\n", strerror(errno));
+        }
+        trace_point(TRACE_KISS_ENCODED);
+        return err;
+    }
+
+    n = kiss_encode(cmd, buf, len, frame);
+    trace_point(TRACE_KISS_ENCODED);
+
+    return kiss_write(frame, n);
+}
+
+/**
+ * Put an encoded link frame on the radio link: FEC, then the loopback
+ * channel or the KISS transport
+ * @param sess the session sending it
+ * @param buf the link frame
+ * @param len the length of the frame
+ * @return 0 on success, -1 on error, -2 if the transport is backed up
+ */
+static int wire_send(struct session *sess, const uint8_t *buf, int len)
+{
+    uint8_t coded[FEC_MAX_FRAME];
+    int err;
+
+    if (sess->fec_depth) {
+        len = fec_encode(sess->fec_depth, buf, len, coded);
+        if (len < 0) {
+            return -1;
+        }
+        buf = coded;
+    }
+
+    if (loopback) {
+        return channel_send(sess->port, buf, len);
+    }
+
+    err = kiss_send_frame(KISS_CMD(sess->port, KISS_CMD_DATA), buf, len);
+    if (err == 0) {
+        trace_point(TRACE_KISS_WRITTEN);
+    }
+
+    return err;
+}
+
+/**
+ * Send a session's pending aggregate, if any
+ * A lone frame goes out as it is, without the aggregate header.
+ * @return 0 on success, -1 on error, -2 if the transport is backed up and
+ *         the aggregate is still pending
+ */
+static int agg_flush(struct session *sess)
 {
     int err;
+
+    if (sess->agg_count == 0) {
+        return 0;
+    }
+
+    if (sess->agg_count == 1) {
+        err = wire_send(sess, &sess->agg[LINK_HDR_LEN + 1],
+                        sess->agg[LINK_HDR_LEN]);
+    } else {
+        err = wire_send(sess, sess->agg, sess->agg_len);
+    }
+
+    if (err == -2) {
+        return -2;
+    } else if (err < 0) {
+        log_err("ERROR sending aggregate of %d frames on KISS port %d, "
+                "dropping it\n", sess->agg_count, sess->port);
+    }
+
+    sess->agg_len = 0;
+    sess->agg_count = 0;
+    timer_stop(&sess->agg_timer);
+
+    return err;
+}
+
+/* The hold-off is over, send whatever has been packed */
+static void agg_expire(void *arg)
+{
+    struct session *sess = arg;
+
+    if (agg_flush(sess) == -2) {
+        timer_start(&sess->agg_timer, now_ns() + AGG_RETRY_NS);
+    }
+}
+
+/* Send every session's pending aggregate */
+static int agg_flush_all(void)
+{
+    int err = 0;
     int i;
 
+    for (i = 0; i < num_ports; i++) {
+        if (agg_flush(&sessions[i]) == -2) {
+            err = -2;
+        }
+    }
+
+    return err;
+}
+
+/**
+ * Pack an encoded link frame into the session's aggregate, sending the
+ * aggregate first if the frame does not fit
+ * @return 0 on success, -1 on error, -2 if the transport is backed up
+ */
+static int agg_add(struct session *sess, const uint8_t *buf, int len)
+{
+    int n = -1;
+    int err;
+
+    if (len <= LINK_AGG_SUB_MAX) {
+        n = link_agg_append(sess->agg, sess->agg_len, LINK_MAX_FRAME, buf,
+                            len);
+    }
+
+    if (n < 0) {
+        // Keep frames in order: what is packed goes first
+        err = agg_flush(sess);
+        if (err == -2) {
+            return -2;
+        }
+
+        if (len > LINK_AGG_SUB_MAX) {
+            return wire_send(sess, buf, len);
+        }
+        n = link_agg_append(sess->agg, 0, LINK_MAX_FRAME, buf, len);
+    }
+
+    sess->agg_len = n;
+    if (sess->agg_count++ == 0) {
+        timer_start(&sess->agg_timer,
+                    now_ns() + sess->link.agg_holdoff * AGG_HOLDOFF_UNIT_NS);
+    }
+
+    return 0;
+}
+
+/**
+ * Put a data frame on the radio link: link framing, then aggregation or
+ * straight on to FEC and the transport
+ * @param sess the session sending it
+ * @param arq ARQ fields for the link header, or NULL
+ * @param buf the frame
+ * @param len the length of the frame
+ * @return 0 on success, -1 on error, -2 if the transport is backed up
+ */
+static int link_send(struct session *sess, const struct link_arq *arq,
+                     const uint8_t *buf, int len)
+{
+    uint8_t wire[LINK_MAX_FRAME];
+
+    if (link_enabled(&sess->link)) {
+        len = link_encode(&sess->link, arq, buf, len, wire);
+        buf = wire;
+    }
+
+    if (sess->link.agg_holdoff) {
+        return agg_add(sess, buf, len);
+    }
+
+    // Aggregation was just turned off with frames still packed
+    if (agg_flush(sess) == -2) {
+        return -2;
+    }
+
+    return wire_send(sess, buf, len);
+}
+
+/* Sends and resends from the ARQ layer */
+static int arq_xmit(int port, const struct link_arq *arq, const uint8_t *buf,
+                    int len)
+{
+    return link_send(&sessions[port], arq, buf, len);
+}
+
+/**
+ * Send a client's data frame, through ARQ if it is on
+ * @return 0 on success, -1 on error, -2 if the link is backed up
+ */
+static int tx_frame(struct session *sess, const uint8_t *buf, int len)
+{
+    if (len > MAX_PKT_SIZE) {
+        return -1;
+    }
+
+    if (sess->link.arq) {
+        return arq_send(&sess->arq, buf, len);
+    }
+
+    return link_send(sess, NULL, buf, len);
+}
+
+/* Frames from CMD_TX_AT, at their time */
+static int txsched_xmit(int port, const uint8_t *buf, int len)
+{
+    log_data("TX AT", (uint8_t *) buf, len);
+    return tx_frame(&sessions[port], buf, len);
+}
+
+/**
+ * Refuse a frame for now
+ * Later frames from the client are refused too until it sends a NOP, so
+ * none it had already sent can overtake this one. On virtual time, the
+ * client's retry can't succeed until time moves, so stop reading from it
+ * until then rather than spin.
+ * @return -EBUSY
+ */
+static int tx_busy(void)
+{
+    cur_sess->tx_refused = 1;
+    if (clock_is_virtual()) {
+        cur_sess->sim_wait = 1;
+    }
+
+    return -7; // -EBUSY from si446x
+}
+
+int kiss_send_async(int len, uint8_t *buf)
+{
+    int err;
+
     log_data("TX" , buf, len);
- 
-    // Start frame
-    err = kiss_putc(KISS_FEND);
-    if (err < 0) {
-        return -3; // -EINVAL from si446x
+
+    // Behind a refused frame, until the client's NOP says it will retry
+    if (cur_sess->tx_refused) {
+        return -7; // -EBUSY from si446x
+    }
+
+    // Spooled frames go out from spool_drain()
+    if (spool_enabled()) {
+        if (len > MAX_PKT_SIZE) {
+            return -3; // -EINVAL from si446x
+        } else if (spool_append(cur_sess->port, buf, len) < 0) {
+            return tx_busy();
+        }
+        return 0;
     }
 
-    // KISS TX command
-    err = kiss_putc(0x00);
-    if (err < 0) {
+    err = tx_frame(cur_sess, buf, len);
+    if (err == -2) {
+        return tx_busy();
+    } else if (err < 0) {
         return -3; // -EINVAL from si446x
     }
 
-    for (i = 0; i < len; i++) {
-        if (buf[i] == KISS_FEND) {
-            err = kiss_putc(KISS_FESC);
-            if (err < 0) {
-                return -3; // -EINVAL from si446x
-            }
-            
-            err = kiss_putc(KISS_TFEND);
-            if (err < 0) {
-                return -3; // -EINVAL from si446x
-            }
-        } else if (buf[i] == KISS_FESC) {
-            err = kiss_putc(KISS_FESC);
-            if (err < 0) {
-                return -3; // -EINVAL from si446x
-            }
-            
-            err = kiss_putc(KISS_TFESC);
-            if (err < 0) {
-                return -3; // -EINVAL from si446x
+    return 0;
+}
+
+/**
+ * Bytes of the KISS stream the TNC has received
+ */
+static uint64_t kiss_bytes_acked(void)
+{
+    uint64_t held = outbuf_pending(&kiss_out);
+    int unacked = 0;
+
+    // Served clients each have their own queue; the slowest counts
+    if (kiss_listen) {
+        held = kiss_server_unacked();
+    } else if (ioctl(kissfd, SIOCOUTQ, &unacked) == 0) {
+        // Written but unacknowledged bytes are still only in our kernel
+        held += unacked;
+    }
+
+    return kiss_bytes > held ? kiss_bytes - held : 0;
+}
+
+/**
+ * Note how far the spool has been sent
+ */
+static void spool_mark(void)
+{
+    struct spool_mark *m;
+
+    // When full, the newest mark just moves further on
+    if (spool_marks_len == SPOOL_MARKS) {
+        m = &spool_marks[(spool_marks_head + SPOOL_MARKS - 1) % SPOOL_MARKS];
+    } else {
+        m = &spool_marks[(spool_marks_head + spool_marks_len) % SPOOL_MARKS];
+        spool_marks_len++;
+    }
+
+    m->pos = spool_tell();
+    m->bytes = kiss_bytes;
+}
+
+/**
+ * Move the spool's commit marker past every frame the TNC has received
+ */
+static void spool_commit_acked(void)
+{
+    struct spool_pos pos;
+    uint64_t acked;
+    int found = 0;
+
+    memset(&pos, 0, sizeof(pos));
+
+    // UDP and the loopback channel have no acknowledgement; a frame has
+    // left once it is sent
+    if (loopback || udp_kiss) {
+        if (!kiss_udp_pending() && !spool_unmarked) {
+            spool_commit(spool_tell());
+        }
+        spool_marks_len = 0;
+        return;
+    }
+
+    // A client that went away may have taken the only copy of frames
+    // since the last commit, so send those again
+    if (kiss_listen && kiss_server_lost() != spool_lost_seen) {
+        spool_lost_seen = kiss_server_lost();
+        spool_marks_len = 0;
+        spool_rewind();
+        return;
+    }
+
+    acked = kiss_bytes_acked();
+    while (spool_marks_len && spool_marks[spool_marks_head].bytes <= acked) {
+        pos = spool_marks[spool_marks_head].pos;
+        spool_marks_head = (spool_marks_head + 1) % SPOOL_MARKS;
+        spool_marks_len--;
+        found = 1;
+    }
+
+    if (found) {
+        spool_commit(pos);
+    }
+}
+
+/**
+ * Send spooled frames while the link takes them, keeping the KISS queue
+ * under its high water mark so clients are not paused for it
+ */
+static void spool_drain(void)
+{
+    struct spool_rec recs[SPOOL_BATCH];
+    int n;
+    int i;
+
+    if (!spool_enabled()) {
+        return;
+    }
+
+    spool_commit_acked();
+
+    // Frames sent now would go nowhere; keep them until a client is back
+    if (kiss_listen && kiss_server_clients() == 0) {
+        return;
+    }
+
+    while (kiss_backlog() < KISS_OUT_HIGH_WATER &&
+           (n = spool_read(recs, SPOOL_BATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            int err = -1;
+
+            if (recs[i].port < num_ports) {
+                err = tx_frame(&sessions[recs[i].port], recs[i].data,
+                               recs[i].len);
             }
-        } else {
-            err = kiss_putc(buf[i]);
-            if (err < 0) {
-                return -3; // -EINVAL from si446x
+            if (err == -2) {
+                break;
+            } else if (err < 0) {
+                log_err("ERROR sending spooled frame for KISS port %d, "
+                        "dropping it\n", recs[i].port);
             }
         }
+
+        spool_consume(i);
+        if (i) {
+            spool_unmarked = 1;
+        }
+        if (i < n) {
+            break;
+        }
+    }
+
+    // Frames are only on their way once their aggregate has gone out too
+    if (spool_unmarked && agg_flush_all() == 0) {
+        spool_mark();
+        spool_unmarked = 0;
+    }
+}
+
+static int kiss_param_store(struct kiss_params *params, uint8_t param,
+                            uint8_t value)
+{
+    switch (param) {
+        case KISS_CMD_TXDELAY:
+            params->txdelay = value;
+            break;
+        case KISS_CMD_P:
+            params->persist = value;
+            break;
+        case KISS_CMD_SLOTTIME:
+            params->slottime = value;
+            break;
+        case KISS_CMD_TXTAIL:
+            params->txtail = value;
+            break;
+        case KISS_CMD_FULLDUPLEX:
+            params->fullduplex = value;
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
+
+void kiss_params_default(struct kiss_params *params)
+{
+    // Defaults from the KISS spec
+    params->txdelay = 50;
+    params->persist = 63;
+    params->slottime = 10;
+    params->txtail = 0;
+    params->fullduplex = 0;
+}
+
+int kiss_set_param(uint8_t param, uint8_t value)
+{
+    int err;
+
+    if (kiss_param_store(&cur_sess->params, param, value) < 0) {
+        return -3; // -EINVAL from si446x
+    }
+
+    // No TNC to tell
+    if (loopback) {
+        return 0;
     }
 
-    // End frame
-    err = kiss_putc(KISS_FEND);
-    if (err < 0) {
+    err = kiss_send_frame(KISS_CMD(cur_sess->port, param), &value, 1);
+    if (err == -2) {
+        return -7; // -EBUSY from si446x
+    } else if (err < 0) {
         return -3; // -EINVAL from si446x
     }
 
@@ -283,60 +895,255 @@ int open_socket(char *host, int port)
     return sockfd;
 }
 
-int process_kiss(uint8_t *buf, int len)
+/**
+ * Send a session's pending RXDATA_BATCH, if any
+ * @param sess the session
+ */
+static void rx_batch_flush(struct session *sess)
 {
-    uint8_t pkt[MAX_PKT_SIZE];
-    uint8_t cmd;    
-    int i, j;
+    if (sess->batch_len == 0) {
+        return;
+    }
 
-    // Empty frame is allowed, ignore
-    if (len == 0)
+    cur_sess = sess;
+    reply(CMD_RXDATA_BATCH, sess->batch_len, sess->batch);
+    sess->batch_len = 0;
+}
+
+/**
+ * Pass a received packet to the session's client
+ * With batching on, packets are packed as [len][data] records and sent
+ * when the next one doesn't fit or the hold-off runs out.
+ * @param sess the session
+ * @param pkt the packet
+ * @param n the length of the packet
+ */
+static void rx_deliver(struct session *sess, uint8_t *pkt, int n)
+{
+    if (!sess->rx_batch || n + 1 > MAX_PAYLOAD_LEN) {
+        // Keep the order with anything already batched
+        rx_batch_flush(sess);
+        cur_sess = sess;
+        reply(CMD_RXDATA, n, pkt);
+        return;
+    }
+
+    if (sess->batch_len + n + 1 > MAX_PAYLOAD_LEN) {
+        rx_batch_flush(sess);
+    }
+
+    if (sess->batch_len == 0) {
+        sess->batch_due = now_ns() + sess->rx_holdoff * NS_PER_MS;
+    }
+
+    sess->batch[sess->batch_len++] = n;
+    memcpy(&sess->batch[sess->batch_len], pkt, n);
+    sess->batch_len += n;
+}
+
+/**
+ * Filter a received packet and pass it to the session's client
+ * @param sess the session
+ * @param pkt the packet
+ * @param n the length of the packet
+ */
+static void rx_packet(struct session *sess, uint8_t *pkt, int n)
+{
+    // Traffic for other stations on a shared channel stops here
+    if (!ax25_filter_accept(rx_filter, pkt, n)) {
+        rx_filtered++;
+        return;
+    }
+
+    cur_sess = sess;
+    log_data("RX", pkt, n);
+    rx_deliver(sess, pkt, n);
+}
+
+/**
+ * Undo link framing on a received link frame and hand it to the session's
+ * client
+ * @param sess the session the frame is for
+ * @param wire the link frame
+ * @param n the length of the frame
+ * @return 0 on success, -1 if the frame was dropped
+ */
+static int rx_link_frame(struct session *sess, const uint8_t *wire, int n)
+{
+    uint8_t pkt[MAX_PKT_SIZE];
+    struct link_arq arq;
+
+    n = link_decode(&sess->link, &arq, wire, n, pkt, MAX_PKT_SIZE);
+    if (n < 0) {
+        log_err("ERROR receiving frame: bad link frame\n");
+        return -1;
+    }
+
+    // ARQ hands frames on once they are in order
+    if (arq.flags && sess->link.arq) {
+        arq_input(&sess->arq, &arq, pkt, n);
         return 0;
+    }
+    if (arq.flags == LINK_F_ARQ_ACK) {
+        return 0;
+    }
 
-    cmd = buf[0];
+    rx_packet(sess, pkt, n);
 
-    j = 0;
-    for (i = 1; i < len; i++) {
-        
-        if (j == MAX_PKT_SIZE) {
-            log_err("ERROR receiving KISS: Packet too long\n");
+    return 0;
+}
+
+/**
+ * Undo FEC and link framing on a received data frame and hand it to the
+ * session's client, each frame in turn if it is an aggregate
+ * @param sess the session the frame is for
+ * @param wire the frame as received, decoded in place
+ * @param n the length of the frame
+ * @return 0 on success, -1 if the frame was dropped
+ */
+static int rx_frame(struct session *sess, uint8_t *wire, int n)
+{
+    const uint8_t *frame;
+    uint32_t corrected = 0;
+    int pos = LINK_HDR_LEN;
+    int len;
+
+    if (sess->fec_depth) {
+        // Decoded in place, the result is never longer
+        n = fec_decode(wire, n, wire, n, &corrected);
+        if (n < 0) {
+            log_err("ERROR receiving frame: uncorrectable FEC frame\n");
             return -1;
         }
-        
-        if (buf[i] == KISS_FESC) {
-            i++;
-            if (buf[i] == KISS_TFEND) {
-                pkt[j++] = KISS_FEND;
-            } else if (buf[i] == KISS_TFESC) {
-                pkt[j++] = KISS_FESC;
-            } else {
-                log_err("ERROR receiving KISS: invalid transpose\n");
-                return -1; 
-            }
-        } else {
-            pkt[j++] = buf[i];
+        if (corrected) {
+            log_info("FEC corrected %u symbols\n", corrected);
         }
     }
-    
-    if (cmd == 0) {
-        log_data("RX", pkt, j);
-        reply(CMD_RXDATA, j, pkt);
-    } else {
-        log_err("ERROR processing KISS: unknown command %d\n", cmd);
+
+    if (!link_enabled(&sess->link)) {
+        if (n > MAX_PKT_SIZE) {
+            log_err("ERROR receiving frame: Packet too long\n");
+            return -1;
+        }
+        rx_packet(sess, wire, n);
+        return 0;
+    }
+
+    if (n < LINK_HDR_LEN || !(wire[0] & LINK_F_AGGREGATE)) {
+        return rx_link_frame(sess, wire, n);
+    }
+
+    while ((len = link_agg_next(wire, n, &pos, &frame)) > 0) {
+        rx_link_frame(sess, frame, len);
+    }
+    if (len < 0) {
+        log_err("ERROR receiving frame: bad aggregate\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Frames from the ARQ layer, in order */
+static void arq_deliver(int port, uint8_t *buf, int len)
+{
+    rx_packet(&sessions[port], buf, len);
+}
+
+/**
+ * Handle one decoded KISS frame from the TNC
+ * @param cmd the KISS command byte
+ * @param wire the frame, without escaping
+ * @param n the length of the frame
+ * @return 0 on success, -1 if the frame was dropped
+ */
+static int kiss_dispatch(uint8_t cmd, uint8_t *wire, int n)
+{
+    struct session *sess;
+
+    // Only meaningful host to TNC, nothing to do
+    if (cmd == KISS_CMD_RETURN)
+        return 0;
+
+    if (KISS_PORT(cmd) >= num_ports) {
+        log_err("ERROR processing KISS: no session for port %d\n",
+                KISS_PORT(cmd));
         return -1;
     }
+    sess = &sessions[KISS_PORT(cmd)];
+
+    switch (KISS_TYPE(cmd)) {
+        case KISS_CMD_DATA:
+            return rx_frame(sess, wire, n);
+        case KISS_CMD_TXDELAY:
+        case KISS_CMD_P:
+        case KISS_CMD_SLOTTIME:
+        case KISS_CMD_TXTAIL:
+        case KISS_CMD_FULLDUPLEX:
+            if (n < 1) {
+                log_err("ERROR processing KISS: missing parameter\n");
+                return -1;
+            }
+            log_info("KISS port %d: parameter %d = %d\n", sess->port,
+                     KISS_TYPE(cmd), wire[0]);
+            kiss_param_store(&sess->params, KISS_TYPE(cmd), wire[0]);
+            break;
+        default:
+            log_err("ERROR processing KISS: unknown command %d\n", cmd);
+            return -1;
+    }
 
     return 0;
 }
 
+int process_kiss(uint8_t *buf, int len)
+{
+    uint8_t wire[FEC_MAX_FRAME];
+    int n;
+
+    // Empty frame is allowed, ignore
+    if (len == 0)
+        return 0;
+
+    if (buf[0] == KISS_CMD_RETURN)
+        return 0;
+
+    n = kiss_unescape(&buf[1], len - 1, wire, FEC_MAX_FRAME);
+    if (n == -2) {
+        log_err("ERROR receiving KISS: Packet too long\n");
+        return -1;
+    } else if (n < 0) {
+        log_err("ERROR receiving KISS: invalid transpose\n");
+        return -1;
+    }
+    trace_point(TRACE_KISS_DECODED);
+
+    return kiss_dispatch(buf[0], wire, n);
+}
+
+/* A datagram, or a frame from a served client, is already whole and
+ * unescaped */
+static int kiss_frame(uint8_t cmd, uint8_t *data, int len)
+{
+    int ret;
+
+    trace_begin(TRACE_KISS_READ);
+    trace_point(TRACE_KISS_DECODED);
+    ret = kiss_dispatch(cmd, data, len);
+    trace_end();
+
+    return ret;
+}
+
 int kiss_char(uint8_t c)
 {
-    static uint8_t kiss_buf[KISS_BUF_SIZE];
-    static int kiss_buf_len = 0;
-    
     if (c == KISS_FEND) {
         int ret;
+        if (kiss_buf_len) {
+            trace_begin(TRACE_KISS_READ);
+        }
         ret = process_kiss(kiss_buf, kiss_buf_len);
+        trace_end();
         kiss_buf_len = 0;
         return ret;
     } else {
@@ -348,128 +1155,1138 @@ int kiss_char(uint8_t c)
     }
 }
 
+void session_close(struct session *sess)
+{
+    close(sess->fd);
+    sess->fd = -1;
+    sess->throttled = 0;
+    sess->tx_refused = 0;
+    sess->in_pos = sess->in_len = 0;
+    outbuf_init(&sess->out, sess->out_mem, UART_OUT_SIZE);
+}
+
+int session_accept(struct session *sess)
+{
+    struct sockaddr_in clientaddr;
+    socklen_t clientaddr_len = sizeof(clientaddr);
+    int newfd;
+    int flags;
+    int enable = 1;
+
+    newfd = accept(sess->serverfd, (struct sockaddr *) &clientaddr,
+                   &clientaddr_len);
+
+    if (newfd < 0) {
+        log_err("ERROR accepting socket: %s\n", strerror(errno));
+        return 0;
+    }
+
+    log_info("New UART connection on KISS port %d from %s\n", sess->port,
+             inet_ntoa(clientaddr.sin_addr));
+
+    if (sess->fd >= 0) {
+        log_info("Closing existing UART connection\n");
+        session_close(sess);
+    }
+    if (sess->shm.sock >= 0) {
+        log_info("Closing existing shared memory connection\n");
+        shm_close(&sess->shm);
+    }
+
+    flags = fcntl(newfd, F_GETFL, 0);
+    if (flags == -1) {
+        log_err("ERROR getting UART socket flags: %s\n", strerror(errno));
+        return -1;
+    }
+    flags |= O_NONBLOCK;
+    flags = fcntl(newfd, F_SETFL, flags);
+    if (flags == -1) {
+        log_err("ERROR setting UART socket flags: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Replies are small; don't let Nagle hold them behind the
+    // client's delayed ACK
+    if (setsockopt(newfd, IPPROTO_TCP, TCP_NODELAY, &enable,
+                   sizeof(enable)) < 0) {
+        log_err("ERROR setting UART socket options: %s\n",
+                strerror(errno));
+    }
+
+    sess->fd = newfd;
+    memset(&sess->parser, 0, sizeof(sess->parser));
+    sess->throttled = 0;
+    sess->tx_refused = 0;
+    sess->in_pos = sess->in_len = 0;
+    outbuf_init(&sess->out, sess->out_mem, UART_OUT_SIZE);
+
+    return 0;
+}
+
+/**
+ * Parse what has been read from the client, while each command's reply is
+ * sure to fit in its queue; the rest waits for the client to read
+ */
+void session_parse(struct session *sess)
+{
+    cur_sess = sess;
+
+    // Stop taking commands as soon as the KISS side backs up
+    while (sess->in_pos < sess->in_len && !kiss_throttled &&
+           outbuf_space(&sess->out) >= UART_REPLY_RESERVE) {
+        parse_char(&sess->parser, sess->in[sess->in_pos++]);
+    }
+}
+
+int session_read(struct session *sess)
+{
+    int n;
+
+    // Stop taking commands as soon as the KISS side backs up
+    if (kiss_throttled || sess->in_pos < sess->in_len) {
+        return 0;
+    }
+
+    // One read per pass, so a busy client can't starve the KISS side
+    // or hold off signals
+    n = read(sess->fd, sess->in, sizeof(sess->in));
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        log_err("ERROR reading from UART fd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (n == 0) {
+        log_info("UART socket on KISS port %d closed\n", sess->port);
+        session_close(sess);
+        return 0;
+    }
+
+    trace_read(TRACE_UART_READ);
+    sess->in_pos = 0;
+    sess->in_len = n;
+    session_parse(sess);
+
+    return 0;
+}
+
+/**
+ * Take on a shared-memory client whose port has arrived
+ * @param c the client, from shm_poll()
+ * @param port the KISS port it asked for
+ */
+void session_shm_accept(struct shm_conn *c, int port)
+{
+    struct session *sess;
+
+    if (port >= num_ports) {
+        log_err("ERROR shared memory client asked for KISS port %d\n", port);
+        shm_confirm(c, ENOENT);
+        return;
+    }
+
+    if (shm_confirm(c, 0) < 0) {
+        log_err("ERROR sending shared memory to client\n");
+        return;
+    }
+
+    sess = &sessions[port];
+    log_info("New shared memory connection on KISS port %d\n", port);
+
+    // One client per port, whichever transport it uses
+    if (sess->fd >= 0) {
+        log_info("Closing existing UART connection\n");
+        session_close(sess);
+    }
+    if (sess->shm.sock >= 0) {
+        log_info("Closing existing shared memory connection\n");
+        shm_close(&sess->shm);
+    }
+
+    sess->shm = *c;
+    sess->tx_refused = 0;
+}
+
+/**
+ * Whether a shared-memory client has room for the reply to a command
+ */
+static int shm_reply_room(struct session *sess)
+{
+    return lfr_shm_space(&sess->shm.shm->reply) >= SHM_REPLY_RESERVE;
+}
+
+int session_shm_read(struct session *sess)
+{
+    struct lfr_shm_ring *r = &sess->shm.shm->cmd;
+    struct lfr_shm_slot *slot;
+    struct lfr_shm_slot cmd;
+    uint64_t count;
+    int n = 0;
+
+    // Only wakes us from select(), the ring says what to do
+    if (read(sess->shm.cmd_efd, &count, sizeof(count)) < 0 &&
+        errno != EAGAIN) {
+        log_err("ERROR reading shared memory eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    trace_read(TRACE_UART_READ);
+    cur_sess = sess;
+
+    // A bounded batch per pass, like session_read()
+    while (!kiss_throttled && n++ < SHM_BATCH && shm_reply_room(sess) &&
+           (slot = lfr_shm_peek(r)) != NULL) {
+        // The client can still write to the slot; parse a copy of it
+        memcpy(&cmd, slot, sizeof(cmd));
+        lfr_shm_pop(r);
+        parse_frame(cmd.cmd, cmd.len, cmd.payload);
+    }
+
+    return 0;
+}
+
+/**
+ * Hand every socket and all queued state to a new copy of the binary
+ * Returns only if the upgrade failed, in which case we keep serving.
+ * @param argv the argument vector we were started with
+ */
+void upgrade_start(char **argv)
+{
+    struct upgrade_hdr hdr;
+    int fds[HANDOFF_MAX_FDS];
+    int nfds = 0;
+    int len = sizeof(hdr);
+    const void *pool;
+    pid_t pid;
+    int sock;
+    int i;
+
+    if (loopback) {
+        log_err("ERROR upgrade is not supported in loopback mode\n");
+        return;
+    }
+
+    log_info("Upgrading: handing off to a new %s\n", argv[0]);
+
+    for (i = 0; i < num_ports; i++) {
+        rx_batch_flush(&sessions[i]);
+    }
+
+    // Whatever the sockets take now doesn't need to be copied
+    if (udp_kiss) {
+        kiss_udp_flush(kissfd);
+        if (kiss_udp_pending()) {
+            log_err("Dropping %d queued KISS datagrams\n",
+                    kiss_udp_pending());
+        }
+    } else if (kiss_listen) {
+        kiss_server_flush();
+    } else {
+        outbuf_flush(&kiss_out, kissfd);
+    }
+
+    hdr.magic = UPGRADE_MAGIC;
+    hdr.version = UPGRADE_VERSION;
+    hdr.sess_size = sizeof(struct upgrade_sess);
+    hdr.num_ports = num_ports;
+    hdr.kiss_throttled = kiss_throttled;
+    hdr.kiss_buf_len = kiss_buf_len;
+    hdr.kiss_out_len = outbuf_pending(&kiss_out);
+    hdr.has_shm_listener = shm_listenfd >= 0;
+    hdr.spool_pos = spool_tell();
+    hdr.kiss_bytes = kiss_bytes;
+
+    // Sockets go in the order they are read back: listeners, clients, KISS
+    // socket or KISS server sockets, shared memory listener
+    for (i = 0; i < num_ports; i++) {
+        fds[nfds++] = sessions[i].serverfd;
+    }
+
+    for (i = 0; i < num_ports; i++) {
+        struct session *sess = &sessions[i];
+        struct upgrade_sess st;
+
+        memset(&st, 0, sizeof(st));
+        if (sess->fd >= 0) {
+            outbuf_flush(&sess->out, sess->fd);
+            st.has_fd = 1;
+            fds[nfds++] = sess->fd;
+        }
+        if (sess->shm.sock >= 0) {
+            // The new process maps the same memory, so the rings carry over
+            st.has_shm = 1;
+            fds[nfds++] = sess->shm.sock;
+            fds[nfds++] = sess->shm.memfd;
+            fds[nfds++] = sess->shm.cmd_efd;
+            fds[nfds++] = sess->shm.reply_efd;
+        }
+        st.parser = sess->parser;
+        st.params = sess->params;
+        st.link = sess->link;
+        st.fec_depth = sess->fec_depth;
+        st.rx_batch = sess->rx_batch;
+        st.rx_holdoff = sess->rx_holdoff;
+        st.arq = sess->arq;
+        st.agg_len = sess->agg_len;
+        st.agg_count = sess->agg_count;
+        memcpy(st.agg, sess->agg, sizeof(st.agg));
+        st.throttled = sess->throttled;
+        st.tx_refused = sess->tx_refused;
+        st.in_len = sess->in_len - sess->in_pos;
+        st.out_len = outbuf_pending(&sess->out);
+
+        memcpy(&upgrade_buf[len], &st, sizeof(st));
+        len += sizeof(st);
+        memcpy(&upgrade_buf[len], &sess->in[sess->in_pos], st.in_len);
+        len += st.in_len;
+        len += outbuf_peek(&sess->out, &upgrade_buf[len]);
+    }
+    if (kiss_listen) {
+        hdr.kiss_fds = kiss_server_export_fds(&fds[nfds]);
+    } else {
+        fds[nfds] = kissfd;
+        hdr.kiss_fds = 1;
+    }
+    nfds += hdr.kiss_fds;
+    if (shm_listenfd >= 0) {
+        fds[nfds++] = shm_listenfd;
+    }
+
+    // Frames in flight are in the pool, and the new process resends them
+    pool = arq_pool_export(&hdr.arq_pool_len);
+    memcpy(&upgrade_buf[len], pool, hdr.arq_pool_len);
+    len += hdr.arq_pool_len;
+
+    // Scheduled frames keep their times
+    pool = txsched_export(&hdr.txsched_len);
+    memcpy(&upgrade_buf[len], pool, hdr.txsched_len);
+    len += hdr.txsched_len;
+
+    hdr.kiss_server_len = 0;
+    if (kiss_listen) {
+        pool = kiss_server_export(&hdr.kiss_server_len);
+        memcpy(&upgrade_buf[len], pool, hdr.kiss_server_len);
+        len += hdr.kiss_server_len;
+    }
+
+    memcpy(&upgrade_buf[len], kiss_buf, kiss_buf_len);
+    len += kiss_buf_len;
+    len += outbuf_peek(&kiss_out, &upgrade_buf[len]);
+    memcpy(upgrade_buf, &hdr, sizeof(hdr));
+
+    sock = handoff_spawn(argv, &pid);
+    if (sock < 0) {
+        log_err("ERROR starting new process: %s\n", strerror(errno));
+        return;
+    }
+
+    if (handoff_send(sock, fds, nfds, upgrade_buf, len) < 0 ||
+        handoff_wait(sock, UPGRADE_TIMEOUT_MS) < 0) {
+        log_err("ERROR upgrade failed, still serving\n");
+        // Never let two processes serve the same sockets
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(sock);
+        return;
+    }
+
+    log_info("Upgrade complete, %d bytes of state handed off\n", len);
+    exit(0);
+}
+
+/**
+ * Take over the sockets and state of the process that started us
+ * @param sock the handoff socket
+ * @return 0 on success, -1 on error
+ */
+int upgrade_resume(int sock)
+{
+    struct upgrade_hdr hdr;
+    int fds[HANDOFF_MAX_FDS];
+    int nfds;
+    int next = 0;
+    int kiss_next;
+    int len;
+    int pos;
+    int i;
+
+    len = handoff_recv(sock, fds, &nfds, upgrade_buf, sizeof(upgrade_buf));
+    if (len < (int) sizeof(hdr)) {
+        log_err("ERROR receiving upgrade state\n");
+        return -1;
+    }
+
+    memcpy(&hdr, upgrade_buf, sizeof(hdr));
+    pos = sizeof(hdr);
+
+    if (hdr.magic != UPGRADE_MAGIC || hdr.version != UPGRADE_VERSION ||
+        hdr.sess_size != sizeof(struct upgrade_sess) ||
+        hdr.num_ports < 1 || hdr.num_ports > KISS_MAX_PORTS ||
+        hdr.kiss_fds < 1 || (!kiss_listen && hdr.kiss_fds != 1) ||
+        nfds < hdr.num_ports + hdr.kiss_fds + hdr.has_shm_listener) {
+        log_err("ERROR upgrade state from an incompatible version\n");
+        return -1;
+    }
+
+    num_ports = hdr.num_ports;
+    for (i = 0; i < num_ports; i++) {
+        sessions[i].port = i;
+        sessions[i].serverfd = fds[next++];
+    }
+
+    for (i = 0; i < num_ports; i++) {
+        struct session *sess = &sessions[i];
+        struct upgrade_sess st;
+
+        if (len - pos < (int) sizeof(st)) {
+            goto truncated;
+        }
+        memcpy(&st, &upgrade_buf[pos], sizeof(st));
+        pos += sizeof(st);
+
+        // Leave the KISS sockets and shared memory listener at the end
+        if (next + st.has_fd + 4 * st.has_shm >
+            nfds - hdr.kiss_fds - hdr.has_shm_listener) {
+            goto truncated;
+        }
+
+        sess->fd = -1;
+        if (st.has_fd) {
+            sess->fd = fds[next++];
+        }
+
+        sess->shm.sock = -1;
+        if (st.has_shm) {
+            sess->shm.sock = fds[next++];
+            sess->shm.memfd = fds[next++];
+            sess->shm.cmd_efd = fds[next++];
+            sess->shm.reply_efd = fds[next++];
+            if (shm_attach(&sess->shm) < 0) {
+                log_err("ERROR mapping shared memory: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+        sess->parser = st.parser;
+        sess->params = st.params;
+        sess->link = st.link;
+        sess->fec_depth = st.fec_depth;
+        sess->rx_batch = st.rx_batch;
+        sess->rx_holdoff = st.rx_holdoff;
+        sess->batch_len = 0;
+        sess->arq = st.arq;
+        arq_resume(&sess->arq);
+
+        // A packed aggregate gets a fresh hold-off
+        if (st.agg_len < 0 || st.agg_len > LINK_MAX_FRAME) {
+            goto truncated;
+        }
+        sess->agg_len = st.agg_len;
+        sess->agg_count = st.agg_count;
+        memcpy(sess->agg, st.agg, sizeof(sess->agg));
+        if (sess->agg_count) {
+            timer_start(&sess->agg_timer, now_ns() +
+                        sess->link.agg_holdoff * AGG_HOLDOFF_UNIT_NS);
+            spool_unmarked = spool_enabled();
+        }
+
+        // Commands read but not yet parsed
+        if (st.in_len < 0 || st.in_len > KISS_BUF_SIZE ||
+            len - pos < st.in_len) {
+            goto truncated;
+        }
+        memcpy(sess->in, &upgrade_buf[pos], st.in_len);
+        sess->in_pos = 0;
+        sess->in_len = st.in_len;
+        pos += st.in_len;
+        sess->throttled = st.throttled;
+        sess->tx_refused = st.tx_refused;
+
+        outbuf_init(&sess->out, sess->out_mem, UART_OUT_SIZE);
+        if (st.out_len < 0 || len - pos < st.out_len ||
+            outbuf_queue(&sess->out, &upgrade_buf[pos], st.out_len) < 0) {
+            goto truncated;
+        }
+        pos += st.out_len;
+    }
+    kiss_next = next;
+    next += hdr.kiss_fds;
+    if (!kiss_listen) {
+        kissfd = fds[kiss_next];
+    }
+    if (hdr.has_shm_listener) {
+        shm_listenfd = fds[next++];
+    }
+
+    if (hdr.arq_pool_len < 0 || len - pos < hdr.arq_pool_len ||
+        arq_pool_import(&upgrade_buf[pos], hdr.arq_pool_len) < 0) {
+        goto truncated;
+    }
+    pos += hdr.arq_pool_len;
+
+    if (hdr.txsched_len < 0 || len - pos < hdr.txsched_len ||
+        txsched_import(&upgrade_buf[pos], hdr.txsched_len) < 0) {
+        goto truncated;
+    }
+    pos += hdr.txsched_len;
+
+    if (kiss_listen) {
+        if (hdr.kiss_server_len < 0 || len - pos < hdr.kiss_server_len ||
+            kiss_server_import(&fds[kiss_next], hdr.kiss_fds,
+                               &upgrade_buf[pos], hdr.kiss_server_len) < 0) {
+            goto truncated;
+        }
+        pos += hdr.kiss_server_len;
+    }
+
+    // The spool was opened from the same command line; pick up where the
+    // old process was rather than at its last commit
+    if (spool_enabled() && spool_seek(hdr.spool_pos) < 0) {
+        log_err("ERROR resuming spool, resending from the last commit\n");
+    }
+    kiss_bytes = hdr.kiss_bytes;
+
+    if (hdr.kiss_buf_len < 0 || hdr.kiss_buf_len > KISS_BUF_SIZE ||
+        hdr.kiss_out_len < 0 ||
+        len - pos != hdr.kiss_buf_len + hdr.kiss_out_len) {
+        goto truncated;
+    }
+    memcpy(kiss_buf, &upgrade_buf[pos], hdr.kiss_buf_len);
+    kiss_buf_len = hdr.kiss_buf_len;
+    pos += hdr.kiss_buf_len;
+
+    outbuf_init(&kiss_out, kiss_out_mem, KISS_OUT_SIZE);
+    if (outbuf_queue(&kiss_out, &upgrade_buf[pos], hdr.kiss_out_len) < 0) {
+        goto truncated;
+    }
+    kiss_throttled = hdr.kiss_throttled;
+
+    log_info("Took over %d KISS ports and %d sockets from previous process\n",
+             num_ports, nfds);
+    return 0;
+
+truncated:
+    log_err("ERROR upgrade state is truncated\n");
+    return -1;
+}
+
+/**
+ * Shorten the select() timeout so we wake by a deadline
+ * @param due the deadline, from now_ns()
+ * @param tv storage for the timeout
+ * @param timeout the timeout to pass to select(), NULL for none yet
+ */
+static void wake_by(uint64_t due, struct timeval *tv,
+                    struct timeval **timeout)
+{
+    uint64_t now = now_ns();
+    uint64_t wait = due > now ? due - now : 0;
+
+    // Round up so we don't wake just before the deadline
+    wait = (wait + 999) / 1000;
+    if (*timeout && (uint64_t) (*timeout)->tv_sec * 1000000 +
+                    (*timeout)->tv_usec <= wait) {
+        return;
+    }
+
+    tv->tv_sec = wait / 1000000;
+    tv->tv_usec = wait % 1000000;
+    *timeout = tv;
+}
+
+/**
+ * Time has moved: let clients refused for now try again
+ * @return the number that were waiting
+ */
+static int sim_unblock(void)
+{
+    int waiting = 0;
+    int i;
+
+    for (i = 0; i < num_ports; i++) {
+        waiting += sessions[i].sim_wait;
+        sessions[i].sim_wait = 0;
+    }
+
+    return waiting;
+}
+
+/**
+ * select() for simulation: when nothing happens for sim_idle_us of real
+ * time, jump virtual time to the timeout instead of waiting it out
+ * @return as select()
+ */
+static int sim_select(int nfds, fd_set *read_fds, fd_set *write_fds,
+                      struct timeval *timeout)
+{
+    struct timeval idle = {sim_idle_us / 1000000, sim_idle_us % 1000000};
+    fd_set rd = *read_fds;
+    fd_set wr = *write_fds;
+    int n;
+
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+        return select(nfds, read_fds, write_fds, NULL, timeout);
+    }
+
+    // Clients get this long to answer before we decide they are idle
+    n = select(nfds, read_fds, write_fds, NULL, &idle);
+    if (n > 0) {
+        uint64_t real = real_ns();
+
+        // Something spinning is never quiet; let time pass anyway
+        if (!sim_busy_since) {
+            sim_busy_since = real;
+        } else if (real - sim_busy_since > SIM_BUSY_NS) {
+            clock_advance(now_ns() + real - sim_busy_since);
+            sim_busy_since = real;
+            sim_unblock();
+        }
+    }
+    if (n != 0) {
+        return n;
+    }
+    sim_busy_since = 0;
+
+    if (timeout) {
+        clock_advance(now_ns() + (uint64_t) timeout->tv_sec * NS_PER_SEC +
+                      (uint64_t) timeout->tv_usec * 1000);
+        sim_unblock();
+        return 0;
+    }
+
+    // Nothing will move time, so a client we stopped reading must retry
+    // now, and that was the last thing to happen
+    if (sim_unblock()) {
+        return 0;
+    }
+
+    // Only a client can move us on
+    *read_fds = rd;
+    *write_fds = wr;
+    return select(nfds, read_fds, write_fds, NULL, NULL);
+}
+
+static void loopback_deliver(int to, uint8_t *buf, int len)
+{
+    trace_read(TRACE_KISS_READ);
+    trace_begin(TRACE_KISS_READ);
+    rx_frame(&sessions[to], buf, len);
+    trace_end();
+}
+
+/**
+ * Load the callsign filter again from its file
+ * @return 0 on success, -1 on error with the old filter still in use
+ */
+int filter_reload(void)
+{
+    struct ax25_filter *spare = rx_filter == &rx_filters[0] ?
+                                &rx_filters[1] : &rx_filters[0];
+
+    if (ax25_filter_load(spare, filter_path) < 0) {
+        return -1;
+    }
+
+    rx_filter = spare;
+    log_info("Loaded callsign filter, %d stations, %u frames dropped so "
+             "far\n", rx_filter->count, rx_filtered);
+    return 0;
+}
+
+int load_dict(char *path)
+{
+    uint8_t dict[LZSS_DICT_MAX + 1];
+    FILE *f;
+    int n;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        log_err("ERROR opening dictionary %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    n = fread(dict, 1, sizeof(dict), f);
+    fclose(f);
+
+    if (lzss_set_dict(dict, n) < 0) {
+        log_err("ERROR dictionary %s is over %d bytes\n", path, LZSS_DICT_MAX);
+        return -1;
+    }
+
+    log_info("Loaded %d byte compression dictionary\n", n);
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int kiss_port;
     int uart_port;
 
-    int serverfd;
+    char *trace_path = "lfr-trace.json";
+    struct sigaction sa;
+    int compress = LINK_COMPRESS_OFF;
+    int fec_depth = 0;
+    int arq = 0;
+    int agg_holdoff = 0;
+    uint64_t seed = 1;
+    int udp_port = 0;
+    char *shm_path = NULL;
+    struct channel_model model = {0};
+    char **orig_argv = argv;
+    int handoff_fd;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "p:t:T:z:D:f:Ag:Ll:e:d:b:s:V:u:KS:F:Q:")) != -1) {
+        switch (opt) {
+            case 'S':
+                shm_path = optarg;
+                break;
+            case 'Q':
+                if (spool_open(optarg) < 0) {
+                    return -1;
+                }
+                break;
+            case 'F':
+                filter_path = optarg;
+                if (filter_reload() < 0) {
+                    return -1;
+                }
+                break;
+            case 'u':
+                udp_kiss = 1;
+                udp_port = atoi(optarg);
+                break;
+            case 'K':
+                kiss_listen = 1;
+                break;
+            case 'A':
+                arq = 1;
+                break;
+            case 'g':
+                // In microseconds, held in units of AGG_HOLDOFF_UNIT_NS
+                agg_holdoff = (atoi(optarg) + 99) / 100;
+                if (agg_holdoff < 0 || agg_holdoff > UINT8_MAX) {
+                    goto usage;
+                }
+                break;
+            case 'L':
+                loopback = 1;
+                break;
+            case 'l':
+                model.loss = atof(optarg) / 100;
+                break;
+            case 'e':
+                model.ber = atof(optarg);
+                break;
+            case 'd':
+                model.delay_ns = (uint64_t) (atof(optarg) * NS_PER_MS);
+                break;
+            case 'b':
+                model.bitrate = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'V':
+                sim_idle_us = atoi(optarg);
+                if (sim_idle_us < 1) {
+                    goto usage;
+                }
+                break;
+            case 'f':
+                fec_depth = atoi(optarg);
+                if (fec_depth < 0 || fec_depth > FEC_MAX_DEPTH) {
+                    goto usage;
+                }
+                break;
+            case 'z':
+                compress = atoi(optarg);
+                if (compress < LINK_COMPRESS_OFF ||
+                    compress > LINK_COMPRESS_ALWAYS) {
+                    goto usage;
+                }
+                break;
+            case 'D':
+                if (load_dict(optarg) < 0) {
+                    return -1;
+                }
+                break;
+            case 'p':
+                num_ports = atoi(optarg);
+                if (num_ports < 1 || num_ports > KISS_MAX_PORTS) {
+                    goto usage;
+                }
+                break;
+            case 't':
+                trace_set_log(log_err, log_info);
+                trace_init(atoi(optarg));
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            default:
+                goto usage;
+        }
+    }
 
-    fd_set fds;
-    int maxfd = 0;
+    if (model.loss < 0 || model.loss > 1 || model.ber < 0 || model.ber >= 1 ||
+        (kiss_listen && (udp_kiss || loopback)) ||
+        (sim_idle_us && !loopback)) {
+        goto usage;
+    }
 
-    if (argc != 4) {
-        fprintf(stderr, "usage %s hostname port uart_port\n", argv[0]);
+    if (argc - optind != (loopback ? 1 : 3)) {
+usage:
+        fprintf(stderr, "usage %s [-p num_ports] [-t trace_every] "
+                "[-T trace_file] [-z compress_mode] [-D dict_file] "
+                "[-f fec_depth] [-A] [-g agg_us] [-u udp_port | -K] "
+                "[-S shm_socket] [-F filter_file] [-Q spool_dir] "
+                "hostname port uart_port\n"
+                "      %s -L [-l loss_pct] [-e ber] [-d delay_ms] "
+                "[-b bitrate] [-s seed] [-V idle_us] [options] uart_port\n", argv[0], argv[0]);
         return -1;
     }
-    
-    kiss_port = atoi(argv[2]);
-    uart_port = atoi(argv[3]);
-
-    serverfd = open_server(NULL, uart_port);
-    if (serverfd < 0) return -1;
+    argv += optind - 1;
+
+    // A client hanging up with replies in flight must not kill the bridge
+    signal(SIGPIPE, SIG_IGN);
+
+    // No SA_RESTART: the dump happens when select() is interrupted
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigusr1;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = handle_sigusr2;
+    sigaction(SIGUSR2, &sa, NULL);
+    sa.sa_handler = handle_sighup;
+    sigaction(SIGHUP, &sa, NULL);
+
+    if (loopback) {
+        // SAT on uart_port, GND on uart_port + 1
+        num_ports = 2;
+        kiss_port = 0;
+        uart_port = atoi(argv[1]);
+        channel_init(&model, seed);
+        if (sim_idle_us) {
+            // Not zero, which some deadlines use for "now"
+            clock_use_virtual(NS_PER_SEC);
+            log_info("Simulating on virtual time, idle after %d us\n",
+                     sim_idle_us);
+        }
+    } else {
+        kiss_port = atoi(argv[2]);
+        uart_port = atoi(argv[3]);
+    }
 
-    kissfd = open_socket(argv[1], kiss_port);
-    if (kissfd < 0) return -1;
+    rs_init();
+    arq_init(arq_xmit, arq_deliver);
+    txsched_init(txsched_xmit);
+    for (i = 0; i < KISS_MAX_PORTS; i++) {
+        timer_init(&sessions[i].agg_timer, agg_expire, &sessions[i]);
+    }
 
-    if (listen(serverfd, 1)) { 
-        log_err("ERROR listening: %s\n", strerror(errno));
+    // Timers wake us through a timerfd. The default slack of 50 us would
+    // be most of the error in a scheduled frame's time.
+    if (timer_fd() < 0) {
+        log_err("ERROR creating timerfd: %s\n", strerror(errno));
         return -1;
     }
+    prctl(PR_SET_TIMERSLACK, 1);
+
+    handoff_fd = handoff_inherited();
+    if (handoff_fd >= 0) {
+        // Started by an upgrade, the old process still owns everything
+        // until we acknowledge
+        if (upgrade_resume(handoff_fd) < 0) return -1;
+        goto serve;
+    }
 
-    FD_ZERO(&fds);
+    // KISS port N is served on uart_port + N
+    for (i = 0; i < num_ports; i++) {
+        struct session *sess = &sessions[i];
+
+        sess->port = i;
+        sess->fd = -1;
+        sess->shm.sock = -1;
+        kiss_params_default(&sess->params);
+        sess->link.compress = compress;
+        sess->fec_depth = fec_depth;
+        sess->link.arq = arq;
+        sess->link.agg_holdoff = agg_holdoff;
+        arq_reset(&sess->arq, i);
+
+        sess->serverfd = open_server(NULL, uart_port + i);
+        if (sess->serverfd < 0) return -1;
+
+        if (listen(sess->serverfd, 1)) {
+            log_err("ERROR listening: %s\n", strerror(errno));
+            return -1;
+        }
+    }
 
-    FD_SET(serverfd, &fds);
-    if (serverfd > maxfd)
-        maxfd = serverfd;
+    if (shm_path) {
+        shm_listenfd = shm_listen(shm_path);
+        if (shm_listenfd < 0) return -1;
+    }
 
-    FD_SET(kissfd, &fds);
-    if (kissfd > maxfd)
-        maxfd = kissfd;
+    if (loopback) {
+        log_info("Loopback: SAT on port %d, GND on port %d\n", uart_port,
+                 uart_port + 1);
+    } else {
+        if (kiss_listen) {
+            // hostname is the address to listen on
+            if (kiss_server_open(argv[1], kiss_port) < 0) return -1;
+        } else {
+            if (udp_kiss) {
+                kissfd = kiss_udp_open(argv[1], kiss_port, udp_port);
+            } else {
+                kissfd = open_socket(argv[1], kiss_port);
+            }
+            if (kissfd < 0) return -1;
+        }
+    }
+    outbuf_init(&kiss_out, kiss_out_mem, KISS_OUT_SIZE);
 
+serve:
+    if (handoff_fd >= 0) {
+        handoff_ack(handoff_fd);
+        close(handoff_fd);
+    }
 
     while (1) {
         fd_set read_fds;
-        
-        read_fds = fds;
-        if (select (FD_SETSIZE, &read_fds, NULL, NULL, NULL) < 0) {
-            log_err("ERROR in select: %s\n", strerror(errno));    
-            return -1;
+        fd_set write_fds;
+        struct timeval tv;
+        struct timeval *timeout = NULL;
+        int maxfd = kissfd;
+
+        if (trace_dump_req) {
+            trace_dump_req = 0;
+            trace_dump(trace_path);
         }
 
-        if (uartfd > 0 && FD_ISSET(uartfd, &read_fds)) {
-            int n;
-            char c;
-                
-            while (1) {
-                n = read(uartfd, &c, 1);
-            
-                if (n < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        break;
-                    } else {
-                        log_err("ERROR reading from UART fd: %s\n", 
-                                strerror(errno));
-                        return -1;
-                    }
+        if (upgrade_req) {
+            upgrade_req = 0;
+            upgrade_start(orig_argv);
+        }
+
+        if (filter_reload_req) {
+            filter_reload_req = 0;
+            if (filter_path) {
+                filter_reload();
+            }
+        }
+
+        // Before waiting, so a spool left by the last run starts at once
+        spool_drain();
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        if (kissfd >= 0) {
+            FD_SET(kissfd, &read_fds);
+            if (outbuf_pending(&kiss_out) || kiss_udp_pending())
+                FD_SET(kissfd, &write_fds);
+        }
+        if (kiss_listen) {
+            int fd = kiss_server_fds(&read_fds, &write_fds);
+
+            if (fd > maxfd)
+                maxfd = fd;
+        }
+
+        if (loopback) {
+            uint64_t due = channel_next_due();
+
+            if (due != CHANNEL_IDLE) {
+                wake_by(due, &tv, &timeout);
+            }
+        }
+
+        if (spool_marks_len) {
+            wake_by(now_ns() + SPOOL_COMMIT_NS, &tv, &timeout);
+        }
+
+        if (clock_is_virtual()) {
+            uint64_t due = timer_next_due();
+
+            if (due != TIMER_IDLE) {
+                wake_by(due, &tv, &timeout);
+            }
+        } else {
+            timer_arm();
+            FD_SET(timer_fd(), &read_fds);
+            if (timer_fd() > maxfd)
+                maxfd = timer_fd();
+        }
+
+        for (i = 0; i < num_ports; i++) {
+            FD_SET(sessions[i].serverfd, &read_fds);
+            if (sessions[i].serverfd > maxfd)
+                maxfd = sessions[i].serverfd;
+
+            if (sessions[i].batch_len) {
+                wake_by(sessions[i].batch_due, &tv, &timeout);
+            }
+
+            if (sessions[i].fd >= 0) {
+                struct session *sess = &sessions[i];
+
+                // Hold off a client that isn't reading its replies
+                if (!sess->throttled &&
+                    outbuf_pending(&sess->out) > UART_OUT_HIGH_WATER) {
+                    sess->throttled = 1;
+                } else if (sess->throttled &&
+                           outbuf_pending(&sess->out) < UART_OUT_LOW_WATER) {
+                    sess->throttled = 0;
                 }
 
-                if (n == 0) {
-                    log_info("UART socket closed\n");
-                    close(uartfd);
-                    FD_CLR(uartfd, &fds);
-                    uartfd = -1;
-                    break;
+                if (!kiss_throttled && !sess->sim_wait && !sess->throttled &&
+                    sess->in_pos == sess->in_len)
+                    FD_SET(sess->fd, &read_fds);
+                if (outbuf_pending(&sess->out))
+                    FD_SET(sess->fd, &write_fds);
+                if (sess->fd > maxfd)
+                    maxfd = sess->fd;
+            }
+
+            if (sessions[i].shm.sock >= 0) {
+                struct shm_conn *c = &sessions[i].shm;
+
+                // Closing the socket is how the client hangs up
+                FD_SET(c->sock, &read_fds);
+                if (c->sock > maxfd)
+                    maxfd = c->sock;
+
+                if (!kiss_throttled && !sessions[i].sim_wait &&
+                    !shm_reply_room(&sessions[i])) {
+                    // Commands wait until the client reads its replies
+                    wake_by(now_ns() + SHM_REPLY_RETRY_NS, &tv, &timeout);
+                } else if (!kiss_throttled && !sessions[i].sim_wait) {
+                    FD_SET(c->cmd_efd, &read_fds);
+                    if (c->cmd_efd > maxfd)
+                        maxfd = c->cmd_efd;
+
+                    // Commands already waiting won't be signalled
+                    if (lfr_shm_arm(&c->shm->cmd)) {
+                        wake_by(0, &tv, &timeout);
+                    }
                 }
-                
-                parse_char(c);
             }
         }
 
-        if (serverfd > 0 && FD_ISSET(serverfd, &read_fds)) {
-            struct sockaddr_in clientaddr;
-            socklen_t clientaddr_len = sizeof(clientaddr);
-            int newfd;
+        if (shm_listenfd >= 0) {
+            // And clients connected but yet to send their port
+            int fd = shm_pending_fds(&read_fds);
 
-            newfd = accept(serverfd, (struct sockaddr *) &clientaddr, 
-                           &clientaddr_len);
+            FD_SET(shm_listenfd, &read_fds);
+            if (shm_listenfd > maxfd)
+                maxfd = shm_listenfd;
+            if (fd > maxfd)
+                maxfd = fd;
+        }
 
-            if (newfd < 0) {
-                log_err("ERROR accepting socket: %s\n", strerror(errno));
-            } else {
-                int flags;
+        if ((clock_is_virtual() ?
+             sim_select(maxfd + 1, &read_fds, &write_fds, timeout) :
+             select(maxfd + 1, &read_fds, &write_fds, NULL, timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("ERROR in select: %s\n", strerror(errno));    
+            return -1;
+        }
 
-                log_info("New UART connection from %s\n", 
-                         inet_ntoa(clientaddr.sin_addr));
-                
-                if (uartfd > 0) {
-                    log_info("Closing existing UART connection\n");
-                    close(uartfd);
-                    FD_CLR(uartfd, &fds);
-                    uartfd = -1;
-                }
+        if (loopback) {
+            channel_poll(now_ns(), loopback_deliver);
+        }
 
-                flags = fcntl(newfd, F_GETFL, 0);
-                if (flags == -1) {
-                    log_err("ERROR getting UART socket flags: %s\n", strerror(errno));
-                    return -1;
+        // ACKs and retransmissions
+        timer_run(now_ns());
+
+        if (udp_kiss && FD_ISSET(kissfd, &write_fds)) {
+            if (kiss_udp_flush(kissfd) < 0) {
+                log_err("ERROR writing to KISS fd: %s\n", strerror(errno));
+                return -1;
+            }
+        } else if (kissfd >= 0 && FD_ISSET(kissfd, &write_fds)) {
+            if (outbuf_flush(&kiss_out, kissfd) < 0) {
+                log_err("ERROR writing to KISS fd: %s\n", strerror(errno));
+                return -1;
+            }
+        } else if (kiss_listen) {
+            kiss_server_poll(&read_fds, &write_fds, kiss_frame);
+        }
+
+        if (kiss_throttled && kiss_backlog() < KISS_OUT_LOW_WATER) {
+            log_info("KISS backlog drained, resuming LFR clients\n");
+            kiss_throttled = 0;
+        }
+
+        for (i = 0; i < num_ports; i++) {
+            struct session *sess = &sessions[i];
+
+            if (sess->fd >= 0 && FD_ISSET(sess->fd, &write_fds)) {
+                if (outbuf_flush(&sess->out, sess->fd) < 0) {
+                    log_err("ERROR writing to UART fd: %s\n", strerror(errno));
+                    session_close(sess);
                 }
-                flags |= O_NONBLOCK;
-                flags = fcntl(newfd, F_SETFL, flags);
-                if (flags == -1) {
-                    log_err("ERROR setting UART socket flags: %s\n", strerror(errno));
-                    return -1;
+            }
+
+            // Commands left over while the client's replies backed up
+            if (sess->fd >= 0) {
+                session_parse(sess);
+            }
+
+            if (sess->fd >= 0 && FD_ISSET(sess->fd, &read_fds)) {
+                if (session_read(sess) < 0) return -1;
+            }
+
+            if (FD_ISSET(sess->serverfd, &read_fds)) {
+                if (session_accept(sess) < 0) return -1;
+            }
+
+            if (sess->shm.sock >= 0 && FD_ISSET(sess->shm.sock, &read_fds)) {
+                uint8_t c;
+
+                if (read(sess->shm.sock, &c, 1) <= 0) {
+                    log_info("Shared memory client on KISS port %d closed\n",
+                             sess->port);
+                    shm_close(&sess->shm);
                 }
+            }
 
-                uartfd = newfd;
-                            
-                FD_SET(uartfd, &fds);
-                if (uartfd > maxfd)
-                    maxfd = uartfd;
+            if (sess->shm.sock >= 0 && !kiss_throttled &&
+                shm_reply_room(sess) &&
+                (FD_ISSET(sess->shm.cmd_efd, &read_fds) ||
+                 lfr_shm_peek(&sess->shm.shm->cmd))) {
+                if (session_shm_read(sess) < 0) return -1;
             }
         }
 
-        if (kissfd > 0 && FD_ISSET(kissfd, &read_fds)) {
+        if (shm_listenfd >= 0) {
+            struct shm_conn c;
+            int port;
+
+            while ((port = shm_poll(&read_fds, &c)) >= 0) {
+                session_shm_accept(&c, port);
+            }
+
+            // After the poll, so a new client's fd isn't looked for in the
+            // sets
+            if (FD_ISSET(shm_listenfd, &read_fds)) {
+                shm_accept(shm_listenfd);
+            }
+        }
+
+        if (udp_kiss && FD_ISSET(kissfd, &read_fds)) {
+            trace_read(TRACE_KISS_READ);
+            if (kiss_udp_recv(kissfd, kiss_frame) < 0) {
+                log_err("ERROR reading from KISS fd: %s\n", strerror(errno));
+                return -1;
+            }
+        } else if (kissfd >= 0 && FD_ISSET(kissfd, &read_fds)) {
             int n;
             uint8_t buf[KISS_BUF_SIZE];
 
@@ -483,21 +2300,38 @@ int main(int argc, char **argv)
             if (n == 0) {
                 log_err("KISS socket closed\n");
                 close(kissfd);
-                FD_CLR(kissfd, &fds);
                 kissfd = -1;
                 
                 // Can't recover!
                 return -1;
             }
 
+            trace_read(TRACE_KISS_READ);
             for (int i = 0; i < n; i ++) {
                 kiss_char(buf[i]);
             }
             
         }
+
+        // Batches that have waited long enough, including any with no
+        // hold-off that were filled this pass
+        for (i = 0; i < num_ports; i++) {
+            if (sessions[i].batch_len &&
+                sessions[i].batch_due <= now_ns()) {
+                rx_batch_flush(&sessions[i]);
+            }
+        }
+
+        // Everything queued this pass goes out in one sendmmsg()
+        if (udp_kiss && kiss_udp_pending()) {
+            if (kiss_udp_flush(kissfd) < 0) {
+                log_err("ERROR writing to KISS fd: %s\n", strerror(errno));
+                return -1;
+            }
+        }
     }
 
     // ???
 
     return 0;
-}   
+}
@@ -9,26 +9,121 @@
 
 #include <stdint.h>
 
+#include "kiss.h"
+#include "cmd_parser.h"
+#include "lfr_frame.h"
+#include "outbuf.h"
+#include "link.h"
+#include "shm.h"
+#include "arq.h"
+#include "timer.h"
+
 #define MAX_PKT_SIZE 255
 
-#define KISS_BUF_SIZE 512
+/* Largest data frame on the KISS link, including link framing */
+#define LINK_MAX_FRAME (MAX_PKT_SIZE + LINK_HDR_MAX)
+
+/* KISS output queue: LFR clients are paused above the high water mark
+ * and resumed once the socket drains below the low water mark */
+#define KISS_OUT_SIZE 65536
+#define KISS_OUT_HIGH_WATER 49152
+#define KISS_OUT_LOW_WATER 16384
+
+/* Unit of the aggregation hold-off, and how soon to try sending an
+ * aggregate again while the link is backed up */
+#define AGG_HOLDOFF_UNIT_NS (NS_PER_MS / 10)
+#define AGG_RETRY_NS NS_PER_MS
+
+/* In simulation, real time the loop may stay busy before virtual time
+ * starts following it */
+#define SIM_BUSY_NS (100 * NS_PER_MS)
 
-#define KISS_FEND 0xC0
-#define KISS_FESC 0xDB
-#define KISS_TFEND 0xDC
-#define KISS_TFESC 0xDD
+/* Per-client reply queue. A client is not read above the high water mark
+ * until the queue drains below the low water mark, and a command is only
+ * parsed with room for its reply and a batch of received packets flushed
+ * ahead of it, so replies are never dropped. */
+#define UART_OUT_SIZE 16384
+#define UART_OUT_HIGH_WATER 12288
+#define UART_OUT_LOW_WATER 4096
+#define UART_REPLY_RESERVE (2 * LFR_FRAME_MAX)
 
 #define HEXDUMP_WIDTH 16
 
+/**
+ * KISS TNC parameters for one port, in the units of the KISS spec
+ */
+struct kiss_params {
+    uint8_t txdelay;    // 10 ms units
+    uint8_t persist;    // p * 256 - 1
+    uint8_t slottime;   // 10 ms units
+    uint8_t txtail;     // 10 ms units
+    uint8_t fullduplex; // 0 = half duplex
+};
+
+/**
+ * A logical radio: one LFR client bound to one KISS port
+ */
+struct session {
+    int port;
+    int serverfd;
+    int fd;
+    struct cmd_parser parser;
+    struct kiss_params params;
+    struct link_state link;
+    uint8_t fec_depth;
+    struct arq_state arq;
+    struct shm_conn shm; // shared-memory client, instead of fd
+    uint8_t rx_batch;    // coalesce received packets
+    uint8_t rx_holdoff;  // ms to wait for more packets
+    uint64_t batch_due;  // when the pending batch must go out
+    int batch_len;
+    uint8_t batch[MAX_PAYLOAD_LEN];
+    struct timer agg_timer; // sends the pending aggregate
+    int agg_len;         // bytes in the aggregate being packed, 0 for none
+    int agg_count;       // frames in it
+    uint8_t agg[LINK_MAX_FRAME];
+    int sim_wait;        // refused with EBUSY, not read until time moves
+    int tx_refused;      // TXDATA refused with EBUSY, later ones too until NOP
+    int throttled;       // reply queue above its high water mark
+    int in_pos;          // read but not yet parsed: in[in_pos..in_len)
+    int in_len;
+    uint8_t in[KISS_BUF_SIZE];
+    struct outbuf out;
+    uint8_t out_mem[UART_OUT_SIZE];
+};
+
 extern uint8_t sys_stat;
 extern uint16_t tx_gate_bias;
 
+/* The session whose command or received frame is being handled */
+extern struct session *cur_sess;
+
 void set_cmd_flag(uint8_t flag);
 
 void uart_putc(char c);
 void uart_puts(char *s);
+void uart_write(const uint8_t *buf, int len);
+
+/**
+ * Send a reply to a client on a transport that keeps frame boundaries
+ * @param cmd the reply command byte
+ * @param len the payload length
+ * @param payload the payload
+ * @return 0 if sent, -1 if the client needs an LFR framed reply instead
+ */
+int uart_reply(uint8_t cmd, int len, const uint8_t *payload);
+
+/**
+ * Open a TCP socket bound to an address, ready for listen()
+ * @param host the address, NULL for any
+ * @param port the port
+ * @return the socket, or -1 on error
+ */
+int open_server(char *host, int port);
 
 int kiss_send_async(int len, uint8_t *buf);
+int kiss_set_param(uint8_t param, uint8_t value);
+void kiss_params_default(struct kiss_params *params);
 
 void log_err(const char *fmt, ...);
 void log_info(const char *fmt, ...);
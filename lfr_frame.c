@@ -0,0 +1,169 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lfr_frame.h"
+
+/**
+ * States of the decoder, named for the byte the decoder expects next
+ */
+enum lfr_decoder_state_e {D_SYNC0, D_SYNC1, D_CMD, D_LEN, D_PAYLOAD, D_CHECKSUM0,
+                          D_CHECKSUM1};
+
+/* update the mod-256 Fletcher checksum with the byte c */
+uint16_t fletcher(uint16_t old_checksum, uint8_t c) {
+    uint8_t lsb, msb;
+    lsb = old_checksum;
+    msb = (old_checksum >> 8) + c;
+    lsb += msb;
+    return ((uint16_t) msb<<8) | (uint16_t)lsb;
+}
+
+uint16_t fletcher_buf(uint16_t old_checksum, const uint8_t *buf, int len)
+{
+    uint8_t lsb = old_checksum;
+    uint8_t msb = old_checksum >> 8;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        msb += buf[i];
+        lsb += msb;
+    }
+
+    return ((uint16_t) msb << 8) | (uint16_t) lsb;
+}
+
+int lfr_frame_encode(uint8_t cmd, int len, const uint8_t *payload, uint8_t *out)
+{
+    uint16_t chksum;
+
+    if (len < 0 || len > MAX_PAYLOAD_LEN) {
+        return -1;
+    }
+
+    out[0] = SYNCWORD_H;
+    out[1] = SYNCWORD_L;
+    out[2] = cmd;
+    out[3] = len;
+    if (len) {
+        memcpy(&out[4], payload, len);
+    }
+
+    chksum = fletcher_buf(0, &out[2], len + 2);
+    out[len + 4] = chksum >> 8;
+    out[len + 5] = chksum & 0xFF;
+
+    return len + LFR_FRAME_OVERHEAD;
+}
+
+int lfr_encode_batch(const uint8_t *in, int in_len, uint8_t *out, int out_len)
+{
+    int i = 0;
+    int n = 0;
+
+    while (i < in_len) {
+        int len;
+
+        if (in_len - i < 2) {
+            return -1;
+        }
+
+        len = in[i + 1];
+        if (in_len - i - 2 < len || out_len - n < len + LFR_FRAME_OVERHEAD) {
+            return -1;
+        }
+
+        n += lfr_frame_encode(in[i], len, &in[i + 2], &out[n]);
+        i += len + 2;
+    }
+
+    return n;
+}
+
+int lfr_decoder_size(void)
+{
+    return sizeof(struct lfr_decoder);
+}
+
+int lfr_record_max(void)
+{
+    return LFR_RECORD_HDR + MAX_PAYLOAD_LEN;
+}
+
+void lfr_decoder_init(struct lfr_decoder *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->state = D_SYNC0;
+}
+
+int lfr_decode(struct lfr_decoder *d, const uint8_t *in, int in_len,
+               uint8_t *out, int out_len, int *consumed)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < in_len; i++) {
+        uint8_t c = in[i];
+
+        switch (d->state) {
+            case D_SYNC0:
+                if (c == SYNCWORD_H) d->state = D_SYNC1;
+                break;
+            case D_SYNC1:
+                if (c == SYNCWORD_L) d->state = D_CMD;
+                else if (c != SYNCWORD_H) d->state = D_SYNC0;
+                break;
+            case D_CMD:
+                d->cmd = c;
+                d->calc_checksum = fletcher(0, c);
+                d->state = D_LEN;
+                break;
+            case D_LEN:
+                d->len = c;
+                d->count = 0;
+                d->calc_checksum = fletcher(d->calc_checksum, c);
+                d->state = c ? D_PAYLOAD : D_CHECKSUM0;
+                break;
+            case D_PAYLOAD:
+                d->payload[d->count++] = c;
+                if (d->count == d->len) {
+                    d->calc_checksum = fletcher_buf(d->calc_checksum,
+                                                    d->payload, d->len);
+                    d->state = D_CHECKSUM0;
+                }
+                break;
+            case D_CHECKSUM0:
+                d->checksum = (uint16_t) c << 8;
+                d->state = D_CHECKSUM1;
+                break;
+            case D_CHECKSUM1:
+                if (out_len - n < LFR_RECORD_HDR + d->len) {
+                    // No room for this record, leave the byte for next time
+                    *consumed = i;
+                    return n ? n : -1;
+                }
+
+                d->checksum |= c;
+                if (d->checksum == d->calc_checksum) {
+                    out[n] = 0;
+                } else {
+                    out[n] = ECMDBADSUM;
+                    d->bad_frames++;
+                }
+                out[n + 1] = d->cmd;
+                out[n + 2] = d->len;
+                memcpy(&out[n + LFR_RECORD_HDR], d->payload, d->len);
+                n += LFR_RECORD_HDR + d->len;
+                d->state = D_SYNC0;
+                break;
+        }
+    }
+
+    *consumed = in_len;
+    return n;
+}
@@ -0,0 +1,114 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef LFR_FRAME_H
+#define LFR_FRAME_H
+
+#include <stdint.h>
+
+#include "cmd_parser.h"
+
+/* sync word + cmd + len + 16-bit checksum */
+#define LFR_FRAME_OVERHEAD 6
+#define LFR_FRAME_MAX (MAX_PAYLOAD_LEN + LFR_FRAME_OVERHEAD)
+
+/* Size of the per-frame header in the records produced by lfr_decode() */
+#define LFR_RECORD_HDR 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Streaming LFR frame decoder
+ * Holds the state between calls so frames may span several buffers
+ */
+struct lfr_decoder {
+    uint8_t state;
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t count;
+    uint16_t checksum;
+    uint16_t calc_checksum;
+    uint32_t bad_frames;
+    uint8_t payload[MAX_PAYLOAD_LEN];
+};
+
+/**
+ * Update the mod-256 Fletcher checksum with one byte
+ * @param old_checksum the running checksum
+ * @param c the next byte
+ */
+uint16_t fletcher(uint16_t old_checksum, uint8_t c);
+
+/**
+ * Update the mod-256 Fletcher checksum with a whole buffer
+ * @param old_checksum the running checksum
+ * @param buf the data
+ * @param len the length of the data in bytes
+ */
+uint16_t fletcher_buf(uint16_t old_checksum, const uint8_t *buf, int len);
+
+/**
+ * Encode one LFR frame (sync word, header, payload and checksum)
+ * @param cmd the command byte, sent as-is
+ * @param len the payload length (at most MAX_PAYLOAD_LEN)
+ * @param payload the payload, may be NULL when len is 0
+ * @param out destination, must hold len + LFR_FRAME_OVERHEAD bytes
+ * @return the number of bytes written, or -1 if len is invalid
+ */
+int lfr_frame_encode(uint8_t cmd, int len, const uint8_t *payload, uint8_t *out);
+
+/**
+ * Encode a batch of LFR frames
+ * The input is a sequence of [cmd][len][payload] records.
+ * @param in the records
+ * @param in_len total length of the records in bytes
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @return the number of bytes written, or -1 on malformed input or overflow
+ */
+int lfr_encode_batch(const uint8_t *in, int in_len, uint8_t *out, int out_len);
+
+/**
+ * Size of struct lfr_decoder, for callers that allocate it themselves
+ */
+int lfr_decoder_size(void);
+
+/**
+ * Largest record lfr_decode() writes; an out buffer this big always has
+ * room for the next one
+ */
+int lfr_record_max(void);
+
+/**
+ * Reset a decoder to wait for a sync word
+ */
+void lfr_decoder_init(struct lfr_decoder *d);
+
+/**
+ * Decode a buffer of received bytes
+ * Every complete frame is written to out as a [status][cmd][len][payload]
+ * record, where status is 0 or ECMDBADSUM. Decoding stops early if the
+ * next record would not fit; an out buffer of lfr_record_max() bytes
+ * always has room.
+ * @param d the decoder state
+ * @param in the received bytes
+ * @param in_len the number of received bytes
+ * @param out destination buffer for records
+ * @param out_len size of the destination buffer
+ * @param consumed set to the number of input bytes consumed
+ * @return the number of bytes of records written, -1 if the next record
+ *         would not fit in out_len and none was written
+ */
+int lfr_decode(struct lfr_decoder *d, const uint8_t *in, int in_len,
+               uint8_t *out, int out_len, int *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
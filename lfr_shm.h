@@ -0,0 +1,343 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef LFR_SHM_H
+#define LFR_SHM_H
+
+/*
+ * Shared-memory transport to lfr-tcp
+ *
+ * For flight software on the same host as the bridge. A client connects to
+ * the bridge's Unix socket and sends the KISS port it wants. The bridge
+ * answers with a status byte and three descriptors: a memfd holding
+ * struct lfr_shm, and eventfds for each direction. Commands and replies
+ * are the usual LFR command set, one per slot, without the sync word and
+ * checksum. Each ring has a single producer and a single consumer, and an
+ * eventfd is only written when the consumer has said it is going to sleep.
+ *
+ * The Unix socket stays open for the life of the client; closing it
+ * disconnects. This header is all a client needs.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LFR_SHM_MAGIC 0x4C465253 // "LFRS"
+#define LFR_SHM_VERSION 1
+
+/* Slots per ring, a power of two */
+#define LFR_SHM_SLOTS 256
+
+#define LFR_SHM_PAYLOAD_MAX 255
+
+/* Polls of an empty ring before a consumer sleeps on the eventfd */
+#define LFR_SHM_SPIN 2000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * One command or reply: the command byte (with the reply bit set for
+ * replies) and its payload
+ */
+struct lfr_shm_slot {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t payload[LFR_SHM_PAYLOAD_MAX + 1];
+};
+
+/**
+ * Single-producer/single-consumer ring
+ * head and tail count slots forever and are only ever compared, so they
+ * may wrap. Producer and consumer fields are on separate cache lines.
+ */
+struct lfr_shm_ring {
+    uint32_t head;          // next slot the producer fills
+    uint32_t pad0[15];
+    uint32_t tail;          // next slot the consumer takes
+    uint32_t waiting;       // consumer is about to sleep on the eventfd
+    uint32_t pad1[14];
+    struct lfr_shm_slot slot[LFR_SHM_SLOTS];
+};
+
+struct lfr_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pad[14];
+    struct lfr_shm_ring cmd;    // client to bridge
+    struct lfr_shm_ring reply;  // bridge to client
+};
+
+/**
+ * Add a slot to a ring (producer only)
+ * @return 0 on success, -1 if the ring is full or len is too long
+ */
+static inline int lfr_shm_push(struct lfr_shm_ring *r, uint8_t cmd, int len,
+                               const uint8_t *payload)
+{
+    uint32_t head = r->head;
+    struct lfr_shm_slot *s;
+
+    if (len < 0 || len > LFR_SHM_PAYLOAD_MAX ||
+        head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == LFR_SHM_SLOTS) {
+        return -1;
+    }
+
+    s = &r->slot[head % LFR_SHM_SLOTS];
+    s->cmd = cmd;
+    s->len = len;
+    if (len) {
+        memcpy(s->payload, payload, len);
+    }
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * Free slots in a ring (producer only)
+ */
+static inline int lfr_shm_space(struct lfr_shm_ring *r)
+{
+    return LFR_SHM_SLOTS -
+           (int) (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * The oldest slot in a ring (consumer only)
+ * @return the slot, or NULL if the ring is empty
+ */
+static inline struct lfr_shm_slot *lfr_shm_peek(struct lfr_shm_ring *r)
+{
+    uint32_t tail = r->tail;
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+    }
+
+    return &r->slot[tail % LFR_SHM_SLOTS];
+}
+
+/**
+ * Release the slot returned by lfr_shm_peek() (consumer only)
+ */
+static inline void lfr_shm_pop(struct lfr_shm_ring *r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Announce that the consumer is going to sleep (consumer only)
+ * @return non-zero if the ring is not empty, and the consumer must not sleep
+ */
+static inline int lfr_shm_arm(struct lfr_shm_ring *r)
+{
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != r->tail;
+}
+
+/**
+ * Wake the consumer if it is sleeping (producer only, after pushing)
+ * @param efd the ring's eventfd
+ */
+static inline void lfr_shm_notify(struct lfr_shm_ring *r, int efd)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        if (write(efd, &one, sizeof(one)) < 0) {
+            // Counter saturated, the consumer is awake anyway
+        }
+    }
+}
+
+/**
+ * A client's end of the transport
+ */
+struct lfr_shm_client {
+    int sock;
+    int cmd_efd;
+    int reply_efd;
+    struct lfr_shm *shm;
+};
+
+/**
+ * Connect to the bridge
+ * @param c the client
+ * @param path the bridge's Unix socket
+ * @param port the KISS port to bind to
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static inline int lfr_shm_connect(struct lfr_shm_client *c, const char *path,
+                                  int port)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctrl;
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint8_t b = port;
+    int fds[3];
+    void *mem;
+
+    c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->sock < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(c->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        write(c->sock, &b, 1) != 1) {
+        goto fail;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &b;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    if (recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        goto fail;
+    }
+    if (b != 0) {
+        errno = b;
+        goto fail;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        errno = EPROTO;
+        goto fail;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    mem = mmap(NULL, sizeof(struct lfr_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (mem == MAP_FAILED) {
+        close(fds[1]);
+        close(fds[2]);
+        goto fail;
+    }
+
+    c->shm = (struct lfr_shm *) mem;
+    c->cmd_efd = fds[1];
+    c->reply_efd = fds[2];
+
+    if (c->shm->magic != LFR_SHM_MAGIC || c->shm->version != LFR_SHM_VERSION) {
+        munmap(mem, sizeof(struct lfr_shm));
+        close(c->cmd_efd);
+        close(c->reply_efd);
+        errno = EPROTO;
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    close(c->sock);
+    c->sock = -1;
+    return -1;
+}
+
+/**
+ * Send a command
+ * @return 0 on success, -1 if the command ring is full (read some replies
+ *         and try again)
+ */
+static inline int lfr_shm_send(struct lfr_shm_client *c, uint8_t cmd, int len,
+                               const uint8_t *payload)
+{
+    if (lfr_shm_push(&c->shm->cmd, cmd, len, payload) < 0) {
+        return -1;
+    }
+
+    lfr_shm_notify(&c->shm->cmd, c->cmd_efd);
+    return 0;
+}
+
+/**
+ * Receive a reply or RXDATA
+ * @param c the client
+ * @param cmd set to the command byte
+ * @param payload destination, must hold LFR_SHM_PAYLOAD_MAX bytes
+ * @param timeout_ms how long to wait, -1 for ever
+ * @return the payload length, or -1 on timeout or error
+ */
+static inline int lfr_shm_recv(struct lfr_shm_client *c, uint8_t *cmd,
+                               uint8_t *payload, int timeout_ms)
+{
+    struct lfr_shm_ring *r = &c->shm->reply;
+    struct lfr_shm_slot *s;
+    int spin = 0;
+    int len;
+
+    while (!(s = lfr_shm_peek(r))) {
+        struct pollfd pfd;
+        uint64_t count;
+
+        // A reply is usually a few microseconds away, don't sleep for it
+        if (spin++ < LFR_SHM_SPIN) {
+            continue;
+        }
+
+        if (lfr_shm_arm(r)) {
+            continue;
+        }
+
+        pfd.fd = c->reply_efd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return -1;
+        }
+        if (read(c->reply_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    *cmd = s->cmd;
+    len = s->len;
+    memcpy(payload, s->payload, len);
+    lfr_shm_pop(r);
+
+    return len;
+}
+
+/**
+ * Disconnect from the bridge
+ */
+static inline void lfr_shm_close(struct lfr_shm_client *c)
+{
+    munmap(c->shm, sizeof(struct lfr_shm));
+    close(c->cmd_efd);
+    close(c->reply_efd);
+    close(c->sock);
+    c->sock = -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "link.h"
+#include "lzss.h"
+
+int link_enabled(const struct link_state *link)
+{
+    return link->compress != LINK_COMPRESS_OFF || link->arq ||
+           link->agg_holdoff;
+}
+
+int link_encode(struct link_state *link, const struct link_arq *arq,
+                const uint8_t *in, int len, uint8_t *out)
+{
+    int hdr = LINK_HDR_LEN;
+    int n = -1;
+
+    out[0] = LINK_F_ACCEPTS_COMPRESSED;
+
+    if (arq && (arq->flags & LINK_F_ARQ_DATA)) {
+        out[0] |= LINK_F_ARQ_DATA;
+        out[hdr++] = arq->seq;
+        out[hdr++] = arq->base;
+    }
+    if (arq && (arq->flags & LINK_F_ARQ_ACK)) {
+        out[0] |= LINK_F_ARQ_ACK;
+        out[hdr++] = arq->ack;
+        out[hdr++] = arq->sack >> 24;
+        out[hdr++] = arq->sack >> 16;
+        out[hdr++] = arq->sack >> 8;
+        out[hdr++] = arq->sack;
+    }
+
+    if (len > 0 && (link->compress == LINK_COMPRESS_ALWAYS ||
+        (link->compress == LINK_COMPRESS_NEGOTIATE && link->peer_accepts))) {
+        // Only worth it if it saves at least a byte
+        n = lzss_compress(in, len, &out[hdr], len - 1);
+    }
+
+    if (n > 0) {
+        out[0] |= LINK_F_COMPRESSED;
+    } else {
+        memcpy(&out[hdr], in, len);
+        n = len;
+    }
+
+    return n + hdr;
+}
+
+int link_decode(struct link_state *link, struct link_arq *arq,
+                const uint8_t *in, int len, uint8_t *out, int out_len)
+{
+    int hdr = LINK_HDR_LEN;
+
+    if (len < LINK_HDR_LEN) {
+        return -1;
+    }
+
+    link->peer_accepts = !!(in[0] & LINK_F_ACCEPTS_COMPRESSED);
+
+    arq->flags = in[0] & (LINK_F_ARQ_DATA | LINK_F_ARQ_ACK);
+    if (in[0] & LINK_F_ARQ_DATA) {
+        if (len - hdr < LINK_ARQ_DATA_LEN) {
+            return -1;
+        }
+        arq->seq = in[hdr++];
+        arq->base = in[hdr++];
+    }
+    if (in[0] & LINK_F_ARQ_ACK) {
+        if (len - hdr < LINK_ARQ_ACK_LEN) {
+            return -1;
+        }
+        arq->ack = in[hdr++];
+        arq->sack = (uint32_t) in[hdr] << 24 | (uint32_t) in[hdr + 1] << 16 |
+                    (uint32_t) in[hdr + 2] << 8 | in[hdr + 3];
+        hdr += 4;
+    }
+
+    if (in[0] & LINK_F_COMPRESSED) {
+        return lzss_decompress(&in[hdr], len - hdr, out, out_len);
+    }
+
+    if (len - hdr > out_len) {
+        return -1;
+    }
+
+    memcpy(out, &in[hdr], len - hdr);
+    return len - hdr;
+}
+
+int link_agg_append(uint8_t *agg, int agg_len, int agg_max,
+                    const uint8_t *frame, int len)
+{
+    if (agg_len == 0) {
+        agg[0] = LINK_F_AGGREGATE | LINK_F_ACCEPTS_COMPRESSED;
+        agg_len = LINK_HDR_LEN;
+    }
+
+    if (len < 1 || len > LINK_AGG_SUB_MAX || agg_len + 1 + len > agg_max) {
+        return -1;
+    }
+
+    agg[agg_len] = len;
+    memcpy(&agg[agg_len + 1], frame, len);
+
+    return agg_len + 1 + len;
+}
+
+int link_agg_next(const uint8_t *in, int len, int *pos, const uint8_t **frame)
+{
+    int n;
+
+    if (*pos == len) {
+        return 0;
+    }
+
+    n = in[*pos];
+    if (n == 0 || *pos + 1 + n > len) {
+        return -1;
+    }
+
+    *frame = &in[*pos + 1];
+    *pos += 1 + n;
+
+    return n;
+}
@@ -0,0 +1,119 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+/*
+ * Link framing between two bridges
+ *
+ * When enabled on a port, every KISS data frame starts with a one byte
+ * header describing how the rest of the frame was encoded. Both ends of the
+ * link must have link framing enabled on the port.
+ */
+
+#define LINK_HDR_LEN 1
+
+/* Header flags */
+#define LINK_F_COMPRESSED 0x01 // body is LZSS compressed
+#define LINK_F_ARQ_DATA 0x02 // ARQ sequence number and window base follow
+#define LINK_F_ARQ_ACK 0x04 // ARQ acknowledgement and SACK bitmap follow
+#define LINK_F_AGGREGATE 0x08 // several link frames packed together
+#define LINK_F_ACCEPTS_COMPRESSED 0x80 // sender can decompress
+
+/* ARQ fields after the header byte: [seq][base] for data, then
+ * [ack][sack, 4 bytes big endian] for an acknowledgement */
+#define LINK_ARQ_DATA_LEN 2
+#define LINK_ARQ_ACK_LEN 5
+#define LINK_HDR_MAX (LINK_HDR_LEN + LINK_ARQ_DATA_LEN + LINK_ARQ_ACK_LEN)
+
+/* An aggregate is its header byte, then for each frame packed in it a
+ * length byte and the whole link frame, header and all */
+#define LINK_AGG_SUB_MAX 255
+
+/* Compression modes */
+#define LINK_COMPRESS_OFF       0 // no link framing
+#define LINK_COMPRESS_NEGOTIATE 1 // compress once the peer says it can decompress
+#define LINK_COMPRESS_ALWAYS    2 // compress without waiting to hear from the peer
+
+/**
+ * Link framing state of one port
+ */
+struct link_state {
+    uint8_t compress;
+    uint8_t peer_accepts;
+    uint8_t arq;    // selective-repeat ARQ on
+    uint8_t agg_holdoff; // 100 us units to wait for frames to pack, 0 for off
+};
+
+/**
+ * ARQ fields of one frame
+ */
+struct link_arq {
+    uint8_t flags;  // LINK_F_ARQ_DATA and LINK_F_ARQ_ACK
+    uint8_t seq;    // this frame's sequence number
+    uint8_t base;   // oldest frame the sender still holds
+    uint8_t ack;    // next sequence number the receiver expects
+    uint32_t sack;  // bit i: ack + 1 + i was received
+};
+
+/**
+ * Whether frames on this port carry a link header
+ */
+int link_enabled(const struct link_state *link);
+
+/**
+ * Encode a frame for the wire
+ * Frames that do not shrink are sent uncompressed.
+ * @param link the port's link state
+ * @param arq ARQ fields to send, or NULL for none
+ * @param in the frame
+ * @param len the length of the frame
+ * @param out destination, must hold len + LINK_HDR_MAX bytes
+ * @return the encoded length
+ */
+int link_encode(struct link_state *link, const struct link_arq *arq,
+                const uint8_t *in, int len, uint8_t *out);
+
+/**
+ * Decode a frame from the wire
+ * @param link the port's link state
+ * @param arq set to the frame's ARQ fields, flags 0 if it has none
+ * @param in the received frame
+ * @param len the length of the received frame
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @return the decoded length, or -1 if the frame is malformed
+ */
+int link_decode(struct link_state *link, struct link_arq *arq,
+                const uint8_t *in, int len, uint8_t *out, int out_len);
+
+/**
+ * Pack a link frame into an aggregate
+ * @param agg the aggregate
+ * @param agg_len its length so far, 0 to start a new one
+ * @param agg_max the most the aggregate may grow to
+ * @param frame the encoded link frame
+ * @param len the length of the frame
+ * @return the new length of the aggregate, or -1 if the frame does not fit
+ */
+int link_agg_append(uint8_t *agg, int agg_len, int agg_max,
+                    const uint8_t *frame, int len);
+
+/**
+ * Step through the frames packed in an aggregate
+ * @param in the aggregate, header included
+ * @param len the length of the aggregate
+ * @param pos where the next frame is, start at LINK_HDR_LEN
+ * @param frame set to the next frame
+ * @return the length of the frame, 0 at the end, or -1 if the aggregate
+ *         is malformed
+ */
+int link_agg_next(const uint8_t *in, int len, int *pos, const uint8_t **frame);
+
+#endif
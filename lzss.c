@@ -0,0 +1,176 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lzss.h"
+
+#define LZSS_HASH_BITS 9
+#define LZSS_HASH_SIZE (1 << LZSS_HASH_BITS)
+
+static uint8_t dict[LZSS_DICT_MAX];
+static int dict_len = 0;
+
+/* Dictionary followed by the frame being compressed, and its hash chains */
+static uint8_t window[LZSS_DICT_MAX + LZSS_IN_MAX];
+static int16_t head[LZSS_HASH_SIZE];
+static int16_t prev[LZSS_DICT_MAX + LZSS_IN_MAX];
+
+static int lzss_hash(const uint8_t *p)
+{
+    return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (LZSS_HASH_SIZE - 1);
+}
+
+static void lzss_insert(int pos)
+{
+    int h = lzss_hash(&window[pos]);
+    prev[pos] = head[h];
+    head[h] = pos;
+}
+
+int lzss_set_dict(const uint8_t *d, int len)
+{
+    if (len > LZSS_DICT_MAX) {
+        return -1;
+    }
+
+    memcpy(dict, d, len);
+    dict_len = len;
+    return 0;
+}
+
+int lzss_compress(const uint8_t *in, int len, uint8_t *out, int out_len)
+{
+    int end = dict_len + len;
+    int pos = dict_len;
+    int flag_pos = 0;
+    int items = 8;
+    int n = 0;
+    int i;
+
+    if (len > LZSS_IN_MAX) {
+        return -1;
+    }
+
+    memcpy(window, dict, dict_len);
+    memcpy(&window[dict_len], in, len);
+    memset(head, 0xFF, sizeof(head));
+
+    for (i = 0; i < dict_len && i + LZSS_MIN_MATCH <= end; i++) {
+        lzss_insert(i);
+    }
+
+    while (pos < end) {
+        int best_len = 0;
+        int best_dist = 0;
+
+        if (pos + LZSS_MIN_MATCH <= end) {
+            int max = end - pos;
+            int cand = head[lzss_hash(&window[pos])];
+            int tries = LZSS_CHAIN_LIMIT;
+
+            if (max > LZSS_MAX_MATCH) {
+                max = LZSS_MAX_MATCH;
+            }
+
+            for (; cand >= 0 && tries-- > 0; cand = prev[cand]) {
+                int l = 0;
+
+                if (pos - cand > LZSS_MAX_DIST) {
+                    break;
+                }
+
+                while (l < max && window[cand + l] == window[pos + l]) {
+                    l++;
+                }
+
+                if (l > best_len) {
+                    best_len = l;
+                    best_dist = pos - cand;
+                    if (l == max) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (items == 8) {
+            if (n == out_len) {
+                return -1;
+            }
+            flag_pos = n++;
+            out[flag_pos] = 0;
+            items = 0;
+        }
+
+        if (best_len >= LZSS_MIN_MATCH) {
+            if (out_len - n < 2) {
+                return -1;
+            }
+            out[flag_pos] |= 1 << items;
+            out[n++] = (best_dist - 1) >> 4;
+            out[n++] = ((best_dist - 1) & 0x0F) << 4 | (best_len - LZSS_MIN_MATCH);
+        } else {
+            if (n == out_len) {
+                return -1;
+            }
+            best_len = 1;
+            out[n++] = window[pos];
+        }
+        items++;
+
+        for (i = 0; i < best_len; i++, pos++) {
+            if (pos + LZSS_MIN_MATCH <= end) {
+                lzss_insert(pos);
+            }
+        }
+    }
+
+    return n;
+}
+
+int lzss_decompress(const uint8_t *in, int len, uint8_t *out, int out_len)
+{
+    int i = 0;
+    int n = 0;
+
+    while (i < len) {
+        uint8_t flags = in[i++];
+        int item;
+
+        for (item = 0; item < 8 && i < len; item++) {
+            if (flags & (1 << item)) {
+                int dist, mlen, j;
+
+                if (len - i < 2) {
+                    return -1;
+                }
+
+                dist = ((in[i] << 4) | (in[i + 1] >> 4)) + 1;
+                mlen = (in[i + 1] & 0x0F) + LZSS_MIN_MATCH;
+                i += 2;
+
+                if (dist > n + dict_len || out_len - n < mlen) {
+                    return -1;
+                }
+
+                // Byte by byte: matches may overlap their own output
+                for (j = 0; j < mlen; j++, n++) {
+                    int src = n - dist;
+                    out[n] = src >= 0 ? out[src] : dict[dict_len + src];
+                }
+            } else {
+                if (n == out_len) {
+                    return -1;
+                }
+                out[n++] = in[i++];
+            }
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,63 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stdint.h>
+
+/*
+ * Small LZSS codec for single frames
+ *
+ * Each group of up to 8 items is preceded by a flag byte, LSB first, where
+ * a set bit marks a back reference. Literals are one byte. Back references
+ * are two bytes: a 12-bit distance - 1 followed by a 4-bit length - 3.
+ * The window is an optional preset dictionary followed by the frame itself,
+ * so short telemetry frames can match against typical content.
+ *
+ * All working memory is static and sized by the constants below.
+ */
+
+#define LZSS_DICT_MAX 1024
+#define LZSS_IN_MAX 512
+
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH 18
+#define LZSS_MAX_DIST 4096
+
+/* How many earlier candidates to try for each position */
+#define LZSS_CHAIN_LIMIT 32
+
+/**
+ * Set the preset dictionary shared by both ends of the link
+ * @param dict the dictionary, copied
+ * @param len the length of the dictionary (at most LZSS_DICT_MAX)
+ * @return 0 on success, -1 if the dictionary is too long
+ */
+int lzss_set_dict(const uint8_t *dict, int len);
+
+/**
+ * Compress one frame
+ * @param in the frame
+ * @param len the length of the frame (at most LZSS_IN_MAX)
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @return the compressed length, or -1 if it does not fit in out_len
+ */
+int lzss_compress(const uint8_t *in, int len, uint8_t *out, int out_len);
+
+/**
+ * Decompress one frame
+ * @param in the compressed frame
+ * @param len the length of the compressed frame
+ * @param out destination buffer
+ * @param out_len size of the destination buffer
+ * @return the decompressed length, or -1 if the input is malformed or the
+ *         output does not fit
+ */
+int lzss_decompress(const uint8_t *in, int len, uint8_t *out, int out_len);
+
+#endif
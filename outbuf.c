@@ -0,0 +1,129 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+void outbuf_init(struct outbuf *ob, uint8_t *mem, int size)
+{
+    ob->mem = mem;
+    ob->size = size;
+    ob->head = 0;
+    ob->len = 0;
+}
+
+int outbuf_pending(const struct outbuf *ob)
+{
+    return ob->len;
+}
+
+int outbuf_space(const struct outbuf *ob)
+{
+    return ob->size - ob->len;
+}
+
+int outbuf_peek(const struct outbuf *ob, uint8_t *buf)
+{
+    int first = ob->size - ob->head;
+
+    if (first > ob->len) {
+        first = ob->len;
+    }
+
+    memcpy(buf, &ob->mem[ob->head], first);
+    memcpy(buf + first, ob->mem, ob->len - first);
+
+    return ob->len;
+}
+
+static void outbuf_push(struct outbuf *ob, const uint8_t *buf, int len)
+{
+    int tail = (ob->head + ob->len) % ob->size;
+    int first = ob->size - tail;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(&ob->mem[tail], buf, first);
+    memcpy(ob->mem, buf + first, len - first);
+    ob->len += len;
+}
+
+int outbuf_queue(struct outbuf *ob, const uint8_t *buf, int len)
+{
+    if (outbuf_space(ob) < len) {
+        return -2;
+    }
+
+    outbuf_push(ob, buf, len);
+
+    return 0;
+}
+
+int outbuf_write(struct outbuf *ob, int fd, const uint8_t *buf, int len)
+{
+    int n = 0;
+
+    if (outbuf_space(ob) < len) {
+        return -2;
+    }
+
+    // Nothing queued ahead of us, so try the socket directly
+    if (ob->len == 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            n = 0;
+        }
+    }
+
+    outbuf_push(ob, buf + n, len - n);
+
+    return 0;
+}
+
+int outbuf_flush(struct outbuf *ob, int fd)
+{
+    while (ob->len > 0) {
+        struct iovec iov[2];
+        int first = ob->size - ob->head;
+        int n;
+
+        if (first > ob->len) {
+            first = ob->len;
+        }
+
+        iov[0].iov_base = &ob->mem[ob->head];
+        iov[0].iov_len = first;
+        iov[1].iov_base = ob->mem;
+        iov[1].iov_len = ob->len - first;
+
+        n = writev(fd, iov, iov[1].iov_len ? 2 : 1);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+
+        ob->head = (ob->head + n) % ob->size;
+        ob->len -= n;
+    }
+
+    if (ob->len == 0) {
+        ob->head = 0;
+    }
+
+    return 0;
+}
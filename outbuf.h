@@ -0,0 +1,78 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdint.h>
+
+/**
+ * Output queue for a non-blocking stream socket
+ * A ring over caller-provided storage. Writes are all-or-nothing, so a
+ * frame is never split by a full socket buffer.
+ */
+struct outbuf {
+    uint8_t *mem;
+    int size;
+    int head;
+    int len;
+};
+
+/**
+ * Set up an empty queue
+ * @param ob the queue
+ * @param mem backing storage
+ * @param size size of the backing storage in bytes
+ */
+void outbuf_init(struct outbuf *ob, uint8_t *mem, int size);
+
+/**
+ * Bytes accepted but not yet taken by the socket
+ */
+int outbuf_pending(const struct outbuf *ob);
+
+/**
+ * Free space in the queue
+ */
+int outbuf_space(const struct outbuf *ob);
+
+/**
+ * Copy out the queued data, oldest first, without consuming it
+ * @param ob the queue
+ * @param buf destination, must hold outbuf_pending() bytes
+ * @return the number of bytes copied
+ */
+int outbuf_peek(const struct outbuf *ob, uint8_t *buf);
+
+/**
+ * Queue a whole frame without touching the socket
+ * @param ob the queue
+ * @param buf the frame
+ * @param len the length of the frame in bytes
+ * @return 0 on success, -2 if the frame does not fit
+ */
+int outbuf_queue(struct outbuf *ob, const uint8_t *buf, int len);
+
+/**
+ * Write a whole frame, queueing whatever the socket does not take now
+ * @param ob the queue
+ * @param fd the non-blocking socket
+ * @param buf the frame
+ * @param len the length of the frame in bytes
+ * @return 0 on success, -1 on a socket error, -2 if the frame does not fit
+ *         (nothing is written)
+ */
+int outbuf_write(struct outbuf *ob, int fd, const uint8_t *buf, int len);
+
+/**
+ * Write as much queued data as the socket will take
+ * @param ob the queue
+ * @param fd the non-blocking socket
+ * @return 0 on success, -1 on a socket error
+ */
+int outbuf_flush(struct outbuf *ob, int fd);
+
+#endif
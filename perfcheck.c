@@ -0,0 +1,471 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+/*
+ * Throughput check for the codec and command parser in liblfr.a
+ *
+ * Builds LFR and KISS byte streams from a fixed seed, times each decoder
+ * and encoder over them, and prints frames per second as
+ * "flavor bench frames_per_sec" lines. With -b, compares against such a
+ * file instead and fails if any bench is slower than the baseline by more
+ * than the tolerance. The command handlers are stubs that count frames,
+ * so only the parsing is measured.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cmd_parser.h"
+#include "cmd_handler.h"
+#include "lfr_frame.h"
+#include "kiss.h"
+
+#define NUM_FRAMES 20000
+
+/* Each bench is run this many times and the fastest run is kept */
+#define TRIALS 5
+
+/* Shortest run worth timing, in ns */
+#define MIN_RUN_NS 200000000ull
+
+/* Every BAD_EVERY-th LFR frame has a bad checksum */
+#define BAD_EVERY 64
+
+#define CHUNK 4096
+
+struct stream {
+    uint8_t *buf;
+    int len;
+    int frames;     // frames a decoder should deliver
+    int bad;        // frames it should reject
+};
+
+static uint64_t rng_state;
+
+// Frames as [cmd][len][payload] records, the input to the encoders
+static uint8_t *records;
+static int records_len;
+
+static struct stream lfr_stream;
+static int lfr_encoded_len;     // lfr_stream without the line noise
+static struct stream kiss_stream;
+
+static uint8_t scratch[2 * NUM_FRAMES * (MAX_PAYLOAD_LEN + 8)];
+
+// What the stub handlers saw
+static long handled;
+static long errors;
+static uint32_t sink;
+
+/* xorshift64*, as in channel.c */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void cmd_nop() { handled++; }
+void cmd_reset() { handled++; }
+void cmd_get_txpwr() { handled++; }
+void cmd_set_txpwr(uint16_t pwr) { handled++; }
+void cmd_set_freq(uint32_t freq) { handled++; }
+void cmd_abort_tx() { handled++; }
+void cmd_tx_psr() { handled++; }
+void cmd_get_cfg() { handled++; }
+void cmd_save_cfg() { handled++; }
+void cmd_cfg_default() { handled++; }
+void cmd_uptime() { handled++; }
+void cmd_get_queue_depth() { handled++; }
+void cmd_get_tx_stats() { handled++; }
+void cmd_err(int err) { errors++; }
+
+void cmd_tx_data(int len, uint8_t *data)
+{
+    handled++;
+    sink += len + data[len - 1];
+}
+
+void cmd_tx_at(uint8_t clock, uint64_t when, int len, uint8_t *data)
+{
+    handled++;
+    sink += len + data[len - 1];
+}
+
+void cmd_set_cfg(int len, uint8_t *data)
+{
+    handled++;
+    sink += len;
+}
+
+int reply_unframed(uint8_t cmd, int len, const uint8_t *payload)
+{
+    return 0;
+}
+
+int reply_write(const uint8_t *buf, int len)
+{
+    return len;
+}
+
+/**
+ * Make the frames: mostly TXDATA of any length, like a client sending
+ * telemetry, with some short commands mixed in
+ */
+static void make_records(void)
+{
+    int i;
+
+    records = malloc(NUM_FRAMES * (MAX_PAYLOAD_LEN + 2));
+    records_len = 0;
+
+    for (i = 0; i < NUM_FRAMES; i++) {
+        uint8_t *r = &records[records_len];
+        int len;
+        int j;
+
+        switch (rng_next() % 16) {
+            case 0:
+                r[0] = CMD_NOP;
+                len = 0;
+                break;
+            case 1:
+                r[0] = CMD_SET_TXPWR;
+                len = 2;
+                break;
+            default:
+                r[0] = CMD_TXDATA;
+                len = 1 + rng_next() % MAX_PAYLOAD_LEN;
+                break;
+        }
+
+        r[1] = len;
+        for (j = 0; j < len; j++) {
+            r[2 + j] = rng_next();
+        }
+        records_len += 2 + len;
+    }
+}
+
+static void make_lfr_stream(struct stream *s)
+{
+    int pos = 0;
+    int i = 0;
+    int n = 0;
+
+    s->buf = malloc(NUM_FRAMES * (LFR_FRAME_MAX + 4));
+    s->frames = 0;
+    s->bad = 0;
+
+    while (pos < records_len) {
+        int len = records[pos + 1];
+        int m;
+
+        // Line noise between some frames, never a sync byte
+        if (rng_next() % 32 == 0) {
+            s->buf[n++] = 0x55;
+            s->buf[n++] = 0xAA;
+        }
+
+        m = lfr_frame_encode(records[pos], len, &records[pos + 2], &s->buf[n]);
+        if (++i % BAD_EVERY == 0) {
+            s->buf[n + m - 1] ^= 0x01;
+            s->bad++;
+        } else {
+            s->frames++;
+        }
+        n += m;
+        lfr_encoded_len += m;
+        pos += 2 + len;
+    }
+
+    s->len = n;
+}
+
+static void make_kiss_stream(struct stream *s)
+{
+    int pos = 0;
+    int n = 0;
+
+    s->buf = malloc(NUM_FRAMES * KISS_ENCODED_MAX(MAX_PAYLOAD_LEN));
+    s->frames = 0;
+    s->bad = 0;
+
+    while (pos < records_len) {
+        int len = records[pos + 1];
+
+        // KISS carries only the data frames
+        if (records[pos] == CMD_TXDATA) {
+            n += kiss_encode(KISS_CMD(0, KISS_CMD_DATA), &records[pos + 2],
+                             len, &s->buf[n]);
+            s->frames++;
+        }
+        pos += 2 + len;
+    }
+
+    s->len = n;
+}
+
+static int bench_parse_char(void)
+{
+    struct cmd_parser p;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    handled = 0;
+    errors = 0;
+
+    for (i = 0; i < lfr_stream.len; i++) {
+        parse_char(&p, lfr_stream.buf[i]);
+    }
+
+    return handled == lfr_stream.frames && errors == lfr_stream.bad ?
+           handled : -1;
+}
+
+static int bench_lfr_decode(void)
+{
+    struct lfr_decoder d;
+    int frames = 0;
+    int pos = 0;
+
+    lfr_decoder_init(&d);
+
+    while (pos < lfr_stream.len) {
+        int len = lfr_stream.len - pos < CHUNK ? lfr_stream.len - pos : CHUNK;
+        int consumed;
+        int n;
+        int i;
+
+        n = lfr_decode(&d, &lfr_stream.buf[pos], len, scratch,
+                       sizeof(scratch), &consumed);
+        for (i = 0; i < n; i += LFR_RECORD_HDR + scratch[i + 2]) {
+            frames += scratch[i] == 0;
+        }
+        pos += consumed;
+    }
+
+    return frames == lfr_stream.frames ? frames : -1;
+}
+
+static int bench_lfr_encode(void)
+{
+    int n = lfr_encode_batch(records, records_len, scratch, sizeof(scratch));
+
+    return n == lfr_encoded_len ? NUM_FRAMES : -1;
+}
+
+static int bench_kiss_decode(void)
+{
+    struct kiss_decoder d;
+    int frames = 0;
+    int pos = 0;
+
+    kiss_decoder_init(&d);
+
+    while (pos < kiss_stream.len) {
+        int len = kiss_stream.len - pos < CHUNK ? kiss_stream.len - pos : CHUNK;
+        int consumed;
+        int n;
+        int i;
+
+        n = kiss_decode(&d, &kiss_stream.buf[pos], len, scratch,
+                        sizeof(scratch), &consumed);
+        for (i = 0; i < n;
+             i += KISS_RECORD_HDR + (scratch[i + 1] << 8 | scratch[i + 2])) {
+            frames++;
+        }
+        pos += consumed;
+    }
+
+    return frames == kiss_stream.frames ? frames : -1;
+}
+
+static int bench_kiss_encode(void)
+{
+    int frames = 0;
+    int pos = 0;
+    int n = 0;
+
+    while (pos < records_len) {
+        int len = records[pos + 1];
+
+        if (records[pos] == CMD_TXDATA) {
+            n += kiss_encode(KISS_CMD(0, KISS_CMD_DATA), &records[pos + 2],
+                             len, &scratch[n]);
+            frames++;
+        }
+        pos += 2 + len;
+    }
+
+    return n == kiss_stream.len ? frames : -1;
+}
+
+struct bench {
+    const char *name;
+    int (*run)(void);
+};
+
+static const struct bench benches[] = {
+    {"parse_char", bench_parse_char},
+    {"lfr_decode", bench_lfr_decode},
+    {"lfr_encode", bench_lfr_encode},
+    {"kiss_decode", bench_kiss_decode},
+    {"kiss_encode", bench_kiss_encode},
+};
+
+#define NUM_BENCHES (int) (sizeof(benches) / sizeof(benches[0]))
+
+/**
+ * Time a bench
+ * @return frames per second on the fastest trial, or -1 if it gave the
+ *         wrong answer
+ */
+static double measure(const struct bench *b)
+{
+    double best = 0;
+    int t;
+
+    for (t = 0; t < TRIALS; t++) {
+        uint64_t start = now();
+        uint64_t elapsed;
+        long frames = 0;
+
+        do {
+            int n = b->run();
+            if (n < 0) {
+                return -1;
+            }
+            frames += n;
+            elapsed = now() - start;
+        } while (elapsed < MIN_RUN_NS);
+
+        if (frames * 1e9 / elapsed > best) {
+            best = frames * 1e9 / elapsed;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Look up a bench in a baseline file
+ * @return its frames per second, or 0 if it isn't there
+ */
+static double baseline_lookup(FILE *f, const char *flavor, const char *name)
+{
+    char line[128];
+    char fl[32];
+    char nm[32];
+    double fps;
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%31s %31s %lf", fl, nm, &fps) == 3 &&
+            strcmp(fl, flavor) == 0 && strcmp(nm, name) == 0) {
+            return fps;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *flavor = "default";
+    const char *baseline_path = NULL;
+    FILE *baseline = NULL;
+    uint64_t seed = 1;
+    double tolerance = 20;
+    int failed = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "l:b:t:s:")) != -1) {
+        switch (opt) {
+            case 'l':
+                flavor = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage %s [-l flavor] [-b baseline_file] "
+                        "[-t tolerance_pct] [-s seed]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (baseline_path) {
+        baseline = fopen(baseline_path, "r");
+        if (!baseline) {
+            perror(baseline_path);
+            return 2;
+        }
+    }
+
+    rng_state = seed ? seed : 1;
+    make_records();
+    make_lfr_stream(&lfr_stream);
+    make_kiss_stream(&kiss_stream);
+
+    for (i = 0; i < NUM_BENCHES; i++) {
+        double fps = measure(&benches[i]);
+        double base;
+
+        if (fps < 0) {
+            fprintf(stderr, "%s %s: wrong result\n", flavor, benches[i].name);
+            failed = 1;
+            continue;
+        }
+
+        if (!baseline) {
+            printf("%s %s %.0f\n", flavor, benches[i].name, fps);
+            continue;
+        }
+
+        base = baseline_lookup(baseline, flavor, benches[i].name);
+        if (base == 0) {
+            printf("%-8s %-12s %12.0f frames/s (no baseline)\n", flavor,
+                   benches[i].name, fps);
+            continue;
+        }
+
+        printf("%-8s %-12s %12.0f frames/s %+6.1f%%%s\n", flavor,
+               benches[i].name, fps, (fps / base - 1) * 100,
+               fps < base * (1 - tolerance / 100) ? "  REGRESSION" : "");
+        if (fps < base * (1 - tolerance / 100)) {
+            failed = 1;
+        }
+    }
+
+    if (baseline) {
+        fclose(baseline);
+    }
+
+    return failed;
+}
@@ -0,0 +1,299 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rs.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RS_HAVE_SSSE3
+#endif
+
+#define GF_POLY 0x11D
+
+static uint8_t gf_exp[2 * RS_N];
+static uint8_t gf_log[256];
+
+/* gf_lo[c][x] = c * x, gf_hi[c][x] = c * (x << 4), for the PSHUFB kernel */
+static uint8_t gf_lo[256][16] __attribute__((aligned(16)));
+static uint8_t gf_hi[256][16] __attribute__((aligned(16)));
+
+/* rem_tab[p] = x^(RS_NPAR + p) mod g(x), highest power first */
+static uint8_t rem_tab[RS_MAX_K][RS_NPAR];
+
+/* syn_tab[e][i] = alpha^(i * e) */
+static uint8_t syn_tab[RS_N][RS_NPAR];
+
+static void gf_vec_mul_xor_scalar(uint8_t *dst, const uint8_t *vec, uint8_t c);
+static void (*vec_mul_xor)(uint8_t *dst, const uint8_t *vec, uint8_t c) =
+    gf_vec_mul_xor_scalar;
+
+uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0) {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + RS_N - gf_log[b]];
+}
+
+/* alpha^e for any e >= 0 */
+static uint8_t gf_pow_alpha(int e)
+{
+    return gf_exp[e % RS_N];
+}
+
+static void gf_vec_mul_xor_scalar(uint8_t *dst, const uint8_t *vec, uint8_t c)
+{
+    int lc = gf_log[c];
+    int i;
+
+    for (i = 0; i < RS_NPAR; i++) {
+        if (vec[i]) {
+            dst[i] ^= gf_exp[lc + gf_log[vec[i]]];
+        }
+    }
+}
+
+#ifdef RS_HAVE_SSSE3
+__attribute__((target("ssse3")))
+static void gf_vec_mul_xor_ssse3(uint8_t *dst, const uint8_t *vec, uint8_t c)
+{
+    __m128i lo = _mm_load_si128((const __m128i *) gf_lo[c]);
+    __m128i hi = _mm_load_si128((const __m128i *) gf_hi[c]);
+    __m128i mask = _mm_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i < RS_NPAR; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &vec[i]);
+        __m128i d = _mm_loadu_si128((const __m128i *) &dst[i]);
+        __m128i l = _mm_and_si128(v, mask);
+        __m128i h = _mm_and_si128(_mm_srli_epi64(v, 4), mask);
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, l),
+                                  _mm_shuffle_epi8(hi, h));
+        _mm_storeu_si128((__m128i *) &dst[i], _mm_xor_si128(d, p));
+    }
+}
+#endif
+
+void gf_vec_mul_xor(uint8_t *dst, const uint8_t *vec, uint8_t c)
+{
+    if (c) {
+        vec_mul_xor(dst, vec, c);
+    }
+}
+
+void rs_init(void)
+{
+    uint8_t gen[RS_NPAR + 1];
+    uint8_t r[RS_NPAR];
+    int i, j, x;
+
+    x = 1;
+    for (i = 0; i < RS_N; i++) {
+        gf_exp[i] = x;
+        gf_exp[i + RS_N] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= GF_POLY;
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (j = 0; j < 16; j++) {
+            gf_lo[i][j] = gf_mul(i, j);
+            gf_hi[i][j] = gf_mul(i, j << 4);
+        }
+    }
+
+    // g(x) = (x + alpha^0)(x + alpha^1)...(x + alpha^31), gen[d] is x^d
+    memset(gen, 0, sizeof(gen));
+    gen[0] = 1;
+    for (i = 0; i < RS_NPAR; i++) {
+        uint8_t root = gf_pow_alpha(i);
+        for (j = i + 1; j > 0; j--) {
+            gen[j] = gen[j - 1] ^ gf_mul(gen[j], root);
+        }
+        gen[0] = gf_mul(gen[0], root);
+    }
+
+    // x^32 mod g is the low part of g; each further power shifts by x
+    memcpy(r, gen, RS_NPAR);
+    for (i = 0; i < RS_MAX_K; i++) {
+        uint8_t top;
+
+        for (j = 0; j < RS_NPAR; j++) {
+            rem_tab[i][j] = r[RS_NPAR - 1 - j];
+        }
+
+        top = r[RS_NPAR - 1];
+        for (j = RS_NPAR - 1; j > 0; j--) {
+            r[j] = r[j - 1] ^ gf_mul(top, gen[j]);
+        }
+        r[0] = gf_mul(top, gen[0]);
+    }
+
+    for (i = 0; i < RS_N; i++) {
+        for (j = 0; j < RS_NPAR; j++) {
+            syn_tab[i][j] = gf_pow_alpha(i * j);
+        }
+    }
+
+#ifdef RS_HAVE_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        vec_mul_xor = gf_vec_mul_xor_ssse3;
+    }
+#endif
+}
+
+void rs_encode(const uint8_t *data, int k, uint8_t *parity)
+{
+    int j;
+
+    memset(parity, 0, RS_NPAR);
+    for (j = 0; j < k; j++) {
+        gf_vec_mul_xor(parity, rem_tab[k - 1 - j], data[j]);
+    }
+}
+
+static int rs_syndromes(const uint8_t *cw, int n, uint8_t *s)
+{
+    int j;
+    int nonzero = 0;
+
+    memset(s, 0, RS_NPAR);
+    for (j = 0; j < n; j++) {
+        gf_vec_mul_xor(s, syn_tab[n - 1 - j], cw[j]);
+    }
+
+    for (j = 0; j < RS_NPAR; j++) {
+        nonzero |= s[j];
+    }
+
+    return nonzero;
+}
+
+/* evaluate poly (p[d] is the coefficient of x^d) at alpha^e */
+static uint8_t poly_eval(const uint8_t *p, int deg, int e)
+{
+    uint8_t sum = 0;
+    int d;
+
+    for (d = 0; d <= deg; d++) {
+        if (p[d]) {
+            sum ^= gf_exp[(gf_log[p[d]] + d * e) % RS_N];
+        }
+    }
+
+    return sum;
+}
+
+int rs_decode(uint8_t *cw, int n)
+{
+    uint8_t s[RS_NPAR];
+    uint8_t lambda[RS_NPAR + 1], b[RS_NPAR + 1], t[RS_NPAR + 1];
+    uint8_t omega[RS_NPAR];
+    uint8_t bb = 1;
+    int L = 0, m = 1;
+    int i, j, e;
+    int found = 0;
+
+    if (n <= RS_NPAR || n > RS_N) {
+        return -1;
+    }
+
+    if (!rs_syndromes(cw, n, s)) {
+        return 0;
+    }
+
+    // Berlekamp-Massey
+    memset(lambda, 0, sizeof(lambda));
+    memset(b, 0, sizeof(b));
+    lambda[0] = 1;
+    b[0] = 1;
+
+    for (i = 0; i < RS_NPAR; i++) {
+        uint8_t d = s[i];
+        uint8_t coef;
+
+        for (j = 1; j <= L; j++) {
+            d ^= gf_mul(lambda[j], s[i - j]);
+        }
+
+        if (d == 0) {
+            m++;
+            continue;
+        }
+
+        coef = gf_div(d, bb);
+        memcpy(t, lambda, sizeof(t));
+        for (j = 0; j + m <= RS_NPAR; j++) {
+            lambda[j + m] ^= gf_mul(coef, b[j]);
+        }
+
+        if (2 * L <= i) {
+            L = i + 1 - L;
+            memcpy(b, t, sizeof(b));
+            bb = d;
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+
+    if (L > RS_NPAR / 2) {
+        return -1;
+    }
+
+    // Omega(x) = S(x) Lambda(x) mod x^32
+    memset(omega, 0, sizeof(omega));
+    for (i = 0; i < RS_NPAR; i++) {
+        for (j = 0; j <= L && j <= i; j++) {
+            omega[i] ^= gf_mul(s[i - j], lambda[j]);
+        }
+    }
+
+    // Chien search over the positions actually sent, Forney for the values
+    for (e = 0; e < n && found < L; e++) {
+        int inv = RS_N - e; // X^-1 = alpha^-e
+        uint8_t num, den;
+
+        if (poly_eval(lambda, L, inv) != 0) {
+            continue;
+        }
+
+        // Lambda'(x) keeps only the odd terms
+        den = 0;
+        for (j = 1; j <= L; j += 2) {
+            if (lambda[j]) {
+                den ^= gf_exp[(gf_log[lambda[j]] + (j - 1) * inv) % RS_N];
+            }
+        }
+        if (den == 0) {
+            return -1;
+        }
+
+        num = poly_eval(omega, RS_NPAR - 1, inv);
+        cw[n - 1 - e] ^= gf_mul(gf_pow_alpha(e), gf_div(num, den));
+        found++;
+    }
+
+    if (found != L || rs_syndromes(cw, n, s)) {
+        return -1;
+    }
+
+    return found;
+}
@@ -0,0 +1,60 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef RS_H
+#define RS_H
+
+#include <stdint.h>
+
+/*
+ * Reed-Solomon RS(255,223) over GF(256)
+ *
+ * Field polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), generator roots
+ * alpha^0 .. alpha^31. Codewords may be shortened: k data symbols followed
+ * by RS_NPAR parity symbols, for any 1 <= k <= RS_MAX_K. Up to 16 symbol
+ * errors per codeword are corrected.
+ *
+ * Scalar arithmetic uses log/antilog tables. Parity and syndrome
+ * accumulation multiply a 32-symbol vector by one symbol at a time, which
+ * runs on PSHUFB nibble tables when the CPU has SSSE3.
+ */
+
+#define RS_N 255
+#define RS_NPAR 32
+#define RS_MAX_K (RS_N - RS_NPAR)
+
+/**
+ * Build the field and code tables; call once before anything else
+ */
+void rs_init(void);
+
+/**
+ * Multiply two field elements
+ */
+uint8_t gf_mul(uint8_t a, uint8_t b);
+
+/**
+ * dst[i] ^= c * vec[i] for i < RS_NPAR
+ */
+void gf_vec_mul_xor(uint8_t *dst, const uint8_t *vec, uint8_t c);
+
+/**
+ * Compute the parity of a codeword
+ * @param data the k data symbols
+ * @param k number of data symbols (1 to RS_MAX_K)
+ * @param parity destination for RS_NPAR parity symbols
+ */
+void rs_encode(const uint8_t *data, int k, uint8_t *parity);
+
+/**
+ * Correct a codeword in place
+ * @param cw the k data symbols followed by RS_NPAR parity symbols
+ * @param n the codeword length, k + RS_NPAR
+ * @return the number of symbols corrected, or -1 if uncorrectable
+ */
+int rs_decode(uint8_t *cw, int n);
+
+#endif
@@ -0,0 +1,228 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "lfr-tcp.h"
+#include "shm.h"
+
+// Accepted clients yet to send their port, oldest first
+static int pending[SHM_PENDING_MAX];
+static int num_pending = 0;
+
+static void pending_remove(int i)
+{
+    num_pending--;
+    memmove(&pending[i], &pending[i + 1],
+            (num_pending - i) * sizeof(pending[0]));
+}
+
+int shm_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_err("ERROR socket path too long: %s\n", path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        log_err("Error opening socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, 4) < 0) {
+        log_err("ERROR binding %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int shm_attach(struct shm_conn *c)
+{
+    void *mem;
+
+    mem = mmap(NULL, sizeof(struct lfr_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, c->memfd, 0);
+    if (mem == MAP_FAILED) {
+        c->shm = NULL;
+        return -1;
+    }
+
+    c->shm = mem;
+    return 0;
+}
+
+void shm_accept(int listenfd)
+{
+    int fd;
+
+    // Never block: the client's port is read when it arrives
+    fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        log_err("ERROR accepting socket: %s\n", strerror(errno));
+        return;
+    }
+
+    // A client that connects and says nothing can't keep others out
+    if (num_pending == SHM_PENDING_MAX) {
+        log_err("ERROR too many shared memory clients connecting, "
+                "dropping the oldest\n");
+        close(pending[0]);
+        pending_remove(0);
+    }
+
+    pending[num_pending++] = fd;
+}
+
+int shm_pending_fds(fd_set *read_fds)
+{
+    int maxfd = -1;
+    int i;
+
+    for (i = 0; i < num_pending; i++) {
+        FD_SET(pending[i], read_fds);
+        if (pending[i] > maxfd) {
+            maxfd = pending[i];
+        }
+    }
+
+    return maxfd;
+}
+
+/* Set up the shared memory of a client that has sent its port */
+static int shm_setup(struct shm_conn *c)
+{
+    c->memfd = memfd_create("lfr-shm", MFD_CLOEXEC);
+    if (c->memfd < 0 || ftruncate(c->memfd, sizeof(struct lfr_shm)) < 0) {
+        log_err("ERROR creating shared memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    c->cmd_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    c->reply_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->cmd_efd < 0 || c->reply_efd < 0 || shm_attach(c) < 0) {
+        log_err("ERROR setting up shared memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // A fresh memfd is zeroed, so both rings start empty
+    c->shm->magic = LFR_SHM_MAGIC;
+    c->shm->version = LFR_SHM_VERSION;
+
+    return 0;
+}
+
+int shm_poll(fd_set *read_fds, struct shm_conn *c)
+{
+    uint8_t port;
+    int i;
+
+    i = 0;
+    while (i < num_pending) {
+        int fd = pending[i];
+        int n;
+
+        if (!FD_ISSET(fd, read_fds)) {
+            i++;
+            continue;
+        }
+        FD_CLR(fd, read_fds);
+
+        n = read(fd, &port, 1);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            i++;
+            continue;
+        }
+        pending_remove(i);
+        if (n != 1) {
+            log_err("ERROR reading shared memory client's port\n");
+            close(fd);
+            continue;
+        }
+
+        c->sock = fd;
+        c->memfd = c->cmd_efd = c->reply_efd = -1;
+        c->shm = NULL;
+        if (shm_setup(c) < 0) {
+            shm_close(c);
+            continue;
+        }
+
+        return port;
+    }
+
+    return -1;
+}
+
+int shm_confirm(struct shm_conn *c, uint8_t status)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int fds[3] = {c->memfd, c->cmd_efd, c->reply_efd};
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = &status;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (status == 0) {
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    if (sendmsg(c->sock, &msg, MSG_NOSIGNAL) != 1 || status != 0) {
+        shm_close(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+void shm_close(struct shm_conn *c)
+{
+    if (c->shm) {
+        munmap(c->shm, sizeof(struct lfr_shm));
+        c->shm = NULL;
+    }
+    if (c->memfd >= 0) close(c->memfd);
+    if (c->cmd_efd >= 0) close(c->cmd_efd);
+    if (c->reply_efd >= 0) close(c->reply_efd);
+    if (c->sock >= 0) close(c->sock);
+    c->sock = c->memfd = c->cmd_efd = c->reply_efd = -1;
+}
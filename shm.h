@@ -0,0 +1,95 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include <sys/select.h>
+
+#include "lfr_shm.h"
+#include "clock.h"
+
+/* Clients connected but yet to send their port; past this, the oldest is
+ * dropped to make room */
+#define SHM_PENDING_MAX 4
+
+/* Commands taken from a client's ring per pass of the event loop */
+#define SHM_BATCH 64
+
+/* A command is only taken with this many reply slots free: its reply, and
+ * a batch of received packets flushed ahead of it */
+#define SHM_REPLY_RESERVE 2
+
+/* The client doesn't signal that it has read replies, so while its reply
+ * ring is too full to take commands, look again this often */
+#define SHM_REPLY_RETRY_NS (NS_PER_MS / 10)
+
+/**
+ * The bridge's end of one shared-memory client
+ * sock is -1 when no client is connected.
+ */
+struct shm_conn {
+    int sock;
+    int memfd;
+    int cmd_efd;
+    int reply_efd;
+    struct lfr_shm *shm;
+};
+
+/**
+ * Create the Unix socket clients connect to
+ * Replaces a stale socket file left at path.
+ * @param path the socket path
+ * @return the listening socket, or -1 on error
+ */
+int shm_listen(const char *path);
+
+/**
+ * Accept a client, without waiting for it to send its port
+ * @param listenfd the listening socket
+ */
+void shm_accept(int listenfd);
+
+/**
+ * Add the clients yet to send their port to the select() set
+ * @return the highest fd added, -1 for none
+ */
+int shm_pending_fds(fd_set *read_fds);
+
+/**
+ * Read the port of a client that has sent it and set up its shared memory
+ * Call until it returns -1. The client's KISS port is checked by the
+ * caller, who then finishes the handshake with shm_confirm().
+ * @param read_fds the readable set from select(), cleared as clients are
+ *        handled
+ * @param c set up for the new client
+ * @return the KISS port the client asked for, or -1 if no other client is
+ *         ready
+ */
+int shm_poll(fd_set *read_fds, struct shm_conn *c);
+
+/**
+ * Finish the handshake
+ * @param c the new client
+ * @param status 0 to accept the client, or an errno value to refuse it
+ * @return 0 on success, -1 on error (the client is closed)
+ */
+int shm_confirm(struct shm_conn *c, uint8_t status);
+
+/**
+ * Map the shared memory of a client passed in by an upgrade
+ * @param c the client, with its descriptors filled in
+ * @return 0 on success, -1 on error
+ */
+int shm_attach(struct shm_conn *c);
+
+/**
+ * Disconnect a client and release its shared memory
+ */
+void shm_close(struct shm_conn *c);
+
+#endif
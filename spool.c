@@ -0,0 +1,468 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lfr-tcp.h"
+#include "spool.h"
+
+// [crc32][len][port] little endian, then the frame
+#define REC_HDR_LEN 6
+#define REC_MAX (REC_HDR_LEN + 255)
+
+#define COMMIT_MAGIC 0x4C465253 // "LFRS"
+
+/* One copy of the commit marker; the newer valid one of two wins, so a
+ * torn write leaves the other */
+struct commit_slot {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t seg;
+    uint32_t off;
+    uint32_t crc;
+};
+
+struct segment {
+    uint32_t num;
+    uint8_t *mem;
+};
+
+static char spool_dir[256];
+static int enabled = 0;
+static uint32_t crc_table[256];
+
+static struct commit_slot *commit_file;
+static struct spool_pos committed;
+
+static struct segment rd = {0, NULL};
+static uint32_t rd_off;
+static struct segment wr = {0, NULL};
+static uint32_t wr_off;
+
+// Where the last spool_read() stopped, and how many records it returned
+static uint32_t peek_off;
+static int peek_count;
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i;
+    int k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *buf, int len)
+{
+    uint32_t c = 0xFFFFFFFF;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        c = crc_table[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+    }
+
+    return c ^ 0xFFFFFFFF;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void seg_path(uint32_t num, char *path, int size)
+{
+    snprintf(path, size, "%s/%08x.seg", spool_dir, num);
+}
+
+/**
+ * Map a segment file
+ * @param create make it, zero filled, if it does not exist
+ * @return 0 on success, -2 if there is no room for it, -1 on other errors
+ */
+static int seg_map(struct segment *s, uint32_t num, int create)
+{
+    char path[300];
+    struct stat st;
+    void *mem;
+    int fd;
+    int err;
+
+    if (s->mem && s->num == num) {
+        return 0;
+    }
+
+    seg_path(num, path, sizeof(path));
+    fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        if (!create && errno == ENOENT) {
+            return -1;
+        }
+        log_err("ERROR opening spool segment %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Every block is allocated now: a store into a hole of a sparse file
+    // on a full filesystem raises SIGBUS
+    if (create) {
+        if (fstat(fd, &st) < 0) {
+            log_err("ERROR checking spool segment %s: %s\n", path,
+                    strerror(errno));
+            close(fd);
+            return -1;
+        }
+        err = posix_fallocate(fd, 0, SPOOL_SEG_SIZE);
+        if (err) {
+            log_err("ERROR sizing spool segment %s: %s\n", path,
+                    strerror(err));
+            // Don't leave an empty segment behind to be found on restart
+            if (st.st_size == 0) {
+                unlink(path);
+            }
+            close(fd);
+            return -2;
+        }
+    }
+
+    mem = mmap(NULL, SPOOL_SEG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        log_err("ERROR mapping spool segment %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (s->mem) {
+        munmap(s->mem, SPOOL_SEG_SIZE);
+    }
+    s->mem = mem;
+    s->num = num;
+
+    return 0;
+}
+
+/**
+ * Check the record at an offset
+ * @return its length including the header, 0 at the end of the log
+ */
+static int rec_check(const uint8_t *mem, uint32_t off)
+{
+    int len;
+
+    if (off + REC_HDR_LEN > SPOOL_SEG_SIZE) {
+        return 0;
+    }
+
+    len = mem[off + 4];
+    if (len == 0 || off + REC_HDR_LEN + len > SPOOL_SEG_SIZE ||
+        crc32(&mem[off + 4], len + 2) != get32(&mem[off])) {
+        return 0;
+    }
+
+    return REC_HDR_LEN + len;
+}
+
+static int commit_valid(const struct commit_slot *c)
+{
+    return c->magic == COMMIT_MAGIC &&
+           c->crc == crc32((const uint8_t *) c, offsetof(struct commit_slot,
+                                                         crc));
+}
+
+static void commit_write(struct spool_pos pos)
+{
+    const struct commit_slot *cur = commit_valid(&commit_file[0]) &&
+        (!commit_valid(&commit_file[1]) ||
+         (int32_t) (commit_file[0].seq - commit_file[1].seq) > 0) ?
+        &commit_file[0] : &commit_file[1];
+    struct commit_slot *next = cur == &commit_file[0] ? &commit_file[1] :
+                               &commit_file[0];
+
+    next->magic = COMMIT_MAGIC;
+    next->seq = cur->seq + 1;
+    next->seg = pos.seg;
+    next->off = pos.off;
+    next->crc = crc32((const uint8_t *) next, offsetof(struct commit_slot,
+                                                       crc));
+    committed = pos;
+}
+
+static int commit_open(void)
+{
+    char path[300];
+    void *mem;
+    int fd;
+    int err;
+
+    snprintf(path, sizeof(path), "%s/commit", spool_dir);
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_err("ERROR opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Allocated up front, as a store into a hole fails with SIGBUS
+    err = posix_fallocate(fd, 0, 2 * sizeof(struct commit_slot));
+    if (err) {
+        log_err("ERROR sizing %s: %s\n", path, strerror(err));
+        close(fd);
+        return -1;
+    }
+
+    mem = mmap(NULL, 2 * sizeof(struct commit_slot), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        log_err("ERROR mapping %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    commit_file = mem;
+
+    if (commit_valid(&commit_file[0]) &&
+        (!commit_valid(&commit_file[1]) ||
+         (int32_t) (commit_file[0].seq - commit_file[1].seq) > 0)) {
+        committed.seg = commit_file[0].seg;
+        committed.off = commit_file[0].off;
+    } else if (commit_valid(&commit_file[1])) {
+        committed.seg = commit_file[1].seg;
+        committed.off = commit_file[1].off;
+    } else {
+        committed.seg = 0;
+        committed.off = 0;
+    }
+
+    return 0;
+}
+
+/* The newest segment on disk, or the committed one if there is none */
+static uint32_t last_segment(void)
+{
+    uint32_t last = committed.seg;
+    struct dirent *de;
+    unsigned int num;
+    char end;
+    DIR *d;
+
+    d = opendir(spool_dir);
+    if (!d) {
+        return last;
+    }
+
+    while ((de = readdir(d))) {
+        if (sscanf(de->d_name, "%8x.se%c", &num, &end) == 2 && end == 'g' &&
+            (int32_t) (num - last) > 0) {
+            last = num;
+        }
+    }
+    closedir(d);
+
+    return last;
+}
+
+int spool_open(const char *dir)
+{
+    uint32_t last;
+    uint32_t off;
+    int n;
+
+    snprintf(spool_dir, sizeof(spool_dir), "%s", dir);
+    crc_init();
+
+    if (commit_open() < 0) {
+        return -1;
+    }
+
+    // Find the end of the log in the newest segment
+    last = last_segment();
+    if (seg_map(&wr, last, 1) < 0) {
+        return -1;
+    }
+    off = last == committed.seg ? committed.off : 0;
+    while ((n = rec_check(wr.mem, off)) > 0) {
+        off += n;
+    }
+    wr_off = off;
+
+    // A record cut short by a crash must not run into the next one
+    n = SPOOL_SEG_SIZE - off < REC_MAX ? SPOOL_SEG_SIZE - off : REC_MAX;
+    memset(&wr.mem[off], 0, n);
+
+    if (seg_map(&rd, committed.seg, 1) < 0) {
+        return -1;
+    }
+    rd_off = committed.off;
+    peek_off = rd_off;
+    enabled = 1;
+
+    if (rd.num != wr.num || rd_off != wr_off) {
+        log_info("Spool: resuming from segment %u offset %u\n",
+                 committed.seg, committed.off);
+    }
+
+    return 0;
+}
+
+int spool_enabled(void)
+{
+    return enabled;
+}
+
+int spool_append(int port, const uint8_t *buf, int len)
+{
+    uint8_t *p;
+    int err;
+
+    if (len < 1 || len > 255) {
+        return -1;
+    }
+
+    if (wr_off + REC_HDR_LEN + len > SPOOL_SEG_SIZE) {
+        // The rest stays zero, which ends the segment
+        err = seg_map(&wr, wr.num + 1, 1);
+        if (err < 0) {
+            return err;
+        }
+        wr_off = 0;
+    }
+
+    p = &wr.mem[wr_off];
+    memcpy(&p[REC_HDR_LEN], buf, len);
+    p[4] = len;
+    p[5] = port;
+    // The CRC goes last, so a record is only valid once it is all there
+    put32(p, crc32(&p[4], len + 2));
+    wr_off += REC_HDR_LEN + len;
+
+    return 0;
+}
+
+int spool_read(struct spool_rec *recs, int max)
+{
+    uint32_t off = rd_off;
+    int count = 0;
+    int n;
+
+    while (count < max) {
+        if (rd.num == wr.num && off >= wr_off) {
+            break;
+        }
+
+        n = rec_check(rd.mem, off);
+        if (n == 0) {
+            if (rd.num == wr.num) {
+                break;
+            }
+            if (count) {
+                // Hand these out before moving to the next segment
+                break;
+            }
+            // A segment ends in zeros where the next record didn't fit
+            if (off + REC_HDR_LEN <= SPOOL_SEG_SIZE && rd.mem[off + 4]) {
+                log_err("ERROR spool segment %08x is corrupt at %u, "
+                        "skipping the rest\n", rd.num, off);
+            }
+            if (seg_map(&rd, rd.num + 1, 0) < 0) {
+                log_err("ERROR spool segment %08x is missing\n", rd.num + 1);
+                break;
+            }
+            off = 0;
+            rd_off = 0;
+            continue;
+        }
+
+        recs[count].len = rd.mem[off + 4];
+        recs[count].port = rd.mem[off + 5];
+        recs[count].data = &rd.mem[off + REC_HDR_LEN];
+        off += n;
+        count++;
+    }
+
+    peek_off = off;
+    peek_count = count;
+    return count;
+}
+
+void spool_consume(int n)
+{
+    int i;
+
+    // Usually everything read, which needs no walking
+    if (n == peek_count) {
+        rd_off = peek_off;
+        peek_count = 0;
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        rd_off += REC_HDR_LEN + rd.mem[rd_off + 4];
+    }
+}
+
+void spool_commit(struct spool_pos pos)
+{
+    uint32_t seg;
+
+    if (!enabled || (committed.seg == pos.seg && committed.off == pos.off)) {
+        return;
+    }
+
+    seg = committed.seg;
+    commit_write(pos);
+
+    // Segments wholly before the marker are done with
+    for (; seg != pos.seg; seg++) {
+        char path[300];
+
+        seg_path(seg, path, sizeof(path));
+        unlink(path);
+    }
+}
+
+struct spool_pos spool_tell(void)
+{
+    return (struct spool_pos) {rd.num, rd_off};
+}
+
+int spool_seek(struct spool_pos pos)
+{
+    if (pos.off >= SPOOL_SEG_SIZE || seg_map(&rd, pos.seg, 0) < 0) {
+        return -1;
+    }
+
+    rd_off = pos.off;
+    peek_off = pos.off;
+    peek_count = 0;
+    return 0;
+}
+
+void spool_rewind(void)
+{
+    if (enabled) {
+        spool_seek(committed);
+    }
+}
@@ -0,0 +1,109 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+
+/*
+ * Persistent spool of frames waiting for the KISS link
+ *
+ * An append-only log in a directory of fixed-size segment files, each
+ * mmap'd and written in place. A record is a CRC-32, the length, the KISS
+ * port and the frame; unwritten space is zero. A separate commit file
+ * marks how far the log has left the process for good. Segments wholly
+ * before it are deleted. On open, everything after the commit marker is
+ * read again, and the log ends at the first record that does not check
+ * out, such as one cut short by a crash.
+ */
+
+#define SPOOL_SEG_SIZE (1 << 20)
+
+/* Records handed out by one spool_read() */
+#define SPOOL_BATCH 32
+
+/**
+ * A place in the log
+ */
+struct spool_pos {
+    uint32_t seg;
+    uint32_t off;
+};
+
+/**
+ * A record, pointing into the log
+ */
+struct spool_rec {
+    uint8_t port;
+    uint8_t len;
+    const uint8_t *data;
+};
+
+/**
+ * Open or create the spool in a directory and find where to resume
+ * @param dir the directory, which must exist
+ * @return 0 on success, -1 on error
+ */
+int spool_open(const char *dir);
+
+/**
+ * Whether a spool is open
+ */
+int spool_enabled(void);
+
+/**
+ * Add a frame to the end of the log
+ * @param port the KISS port to send it on
+ * @param buf the frame
+ * @param len the length of the frame
+ * @return 0 on success, -2 if the disk is full, -1 if it could not be
+ * stored for another reason
+ */
+int spool_append(int port, const uint8_t *buf, int len);
+
+/**
+ * Records after the read position, without moving it
+ * The records stay valid until the next spool_consume() or
+ * spool_append().
+ * @param recs filled with up to max records
+ * @param max the most to return
+ * @return the number returned, 0 if the log is drained
+ */
+int spool_read(struct spool_rec *recs, int max);
+
+/**
+ * Move the read position past records from spool_read()
+ * @param n how many
+ */
+void spool_consume(int n);
+
+/**
+ * Move the commit marker: a restart resends only what is after it
+ * Deletes segments no longer needed.
+ * @param pos a read position from spool_tell(), once everything before it
+ *        has safely left
+ */
+void spool_commit(struct spool_pos pos);
+
+/**
+ * The read position, for handing off to a new process
+ */
+struct spool_pos spool_tell(void);
+
+/**
+ * Move the read position, to one from spool_tell() in another process
+ * @return 0 on success, -1 if it is not in the log
+ */
+int spool_seek(struct spool_pos pos);
+
+/**
+ * Move the read position back to the commit marker, to send again
+ * everything that has not safely left
+ */
+void spool_rewind(void);
+
+#endif
@@ -0,0 +1,300 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "lfr-tcp.h"
+#include "timer.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+// Each slot is a circular list with itself as the head
+static struct timer wheel[TIMER_LEVELS][TIMER_SLOTS];
+static int wheel_ready = 0;
+
+// The tick the wheel has reached; nothing is due before it
+static uint64_t cur_tick = 0;
+static int count = 0;
+
+static int tfd = -1;
+static uint64_t armed = TIMER_IDLE; // what tfd is set to
+
+static void list_init(struct timer *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static int list_empty(const struct timer *head)
+{
+    return head->next == head;
+}
+
+static void list_add(struct timer *head, struct timer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(struct timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+/* Add a timer behind every one due no later than it */
+static void list_add_sorted(struct timer *head, struct timer *t)
+{
+    struct timer *pos = head->prev;
+
+    // Slots come in order, so this is usually the tail
+    while (pos != head && pos->due > t->due) {
+        pos = pos->prev;
+    }
+    list_add(pos->next, t);
+}
+
+/* Move every timer in from to the end of to */
+static void list_splice(struct timer *from, struct timer *to)
+{
+    if (list_empty(from)) {
+        return;
+    }
+
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    list_init(from);
+}
+
+static void wheel_init(void)
+{
+    int l;
+    int i;
+
+    for (l = 0; l < TIMER_LEVELS; l++) {
+        for (i = 0; i < TIMER_SLOTS; i++) {
+            list_init(&wheel[l][i]);
+        }
+    }
+    wheel_ready = 1;
+}
+
+static uint64_t level_index(uint64_t tick, int level)
+{
+    return tick >> (level * TIMER_LEVEL_BITS);
+}
+
+/* Put a timer in its slot, counted from cur_tick */
+static void wheel_add(struct timer *t)
+{
+    uint64_t tick = t->due / TIMER_TICK_NS;
+    uint64_t idx;
+    int level;
+
+    // Already late, fire on the next run
+    if (tick < cur_tick) {
+        tick = cur_tick;
+    }
+
+    // The highest level where the tick and now are in different slots
+    for (level = TIMER_LEVELS - 1; level > 0; level--) {
+        if (level_index(tick, level) != level_index(cur_tick, level)) {
+            break;
+        }
+    }
+
+    idx = level_index(tick, level);
+    if (idx - level_index(cur_tick, level) > SLOT_MASK) {
+        // Beyond the top level; wait in its last slot and go round again
+        idx = level_index(cur_tick, level) + SLOT_MASK;
+    }
+
+    list_add(&wheel[level][idx & SLOT_MASK], t);
+}
+
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg)
+{
+    t->next = NULL;
+    t->prev = NULL;
+    t->due = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+void timer_start(struct timer *t, uint64_t due)
+{
+    if (!wheel_ready) {
+        wheel_init();
+    }
+
+    timer_stop(t);
+
+    t->due = due;
+    wheel_add(t);
+    count++;
+}
+
+void timer_stop(struct timer *t)
+{
+    if (t->next) {
+        list_del(t);
+        count--;
+    }
+}
+
+int timer_pending(const struct timer *t)
+{
+    return t->next != NULL;
+}
+
+uint64_t timer_next_due(void)
+{
+    int level;
+    int i;
+
+    if (count == 0) {
+        return TIMER_IDLE;
+    }
+
+    // Every timer in a level is due after those in the levels below, and
+    // slots within a level are in order, so the first timer found is in
+    // the earliest slot; it only has to be compared with its neighbours.
+    // The top level's last slot also holds timers further out than any,
+    // so that level is searched whole.
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t idx = level_index(cur_tick, level);
+        uint64_t due = TIMER_IDLE;
+
+        for (i = 0; i < TIMER_SLOTS; i++) {
+            struct timer *head = &wheel[level][(idx + i) & SLOT_MASK];
+            struct timer *t;
+
+            for (t = head->next; t != head; t = t->next) {
+                if (t->due < due) {
+                    due = t->due;
+                }
+            }
+            if (due != TIMER_IDLE && level < TIMER_LEVELS - 1) {
+                return due;
+            }
+        }
+
+        if (due != TIMER_IDLE) {
+            return due;
+        }
+    }
+
+    return TIMER_IDLE;
+}
+
+int timer_fd(void)
+{
+    if (tfd < 0) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    return tfd;
+}
+
+void timer_arm(void)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    uint64_t due = timer_next_due();
+
+    if (tfd < 0 || due == armed) {
+        return;
+    }
+
+    // Zero disarms it, and a time already past fires at once
+    if (due != TIMER_IDLE) {
+        if (due == 0) {
+            due = 1;
+        }
+        its.it_value.tv_sec = due / NS_PER_SEC;
+        its.it_value.tv_nsec = due % NS_PER_SEC;
+    }
+
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+        armed = due;
+    }
+}
+
+void timer_run(uint64_t now)
+{
+    uint64_t now_tick = now / TIMER_TICK_NS;
+    struct timer moved;
+    struct timer expired;
+    uint64_t expirations;
+    int level;
+
+    if (armed != TIMER_IDLE && now >= armed) {
+        // It has gone off; clear it so it can be set again
+        if (read(tfd, &expirations, sizeof(expirations)) < 0 &&
+            errno != EAGAIN) {
+            log_err("ERROR reading timerfd: %s\n", strerror(errno));
+        }
+        armed = TIMER_IDLE;
+    }
+
+    if (count == 0 || now_tick < cur_tick) {
+        if (now_tick > cur_tick) {
+            cur_tick = now_tick;
+        }
+        return;
+    }
+
+    list_init(&moved);
+    list_init(&expired);
+
+    // Take every slot the wheel reaches on its way to now, at each level.
+    // Collect first, so callbacks can start and stop timers freely.
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t from = level_index(cur_tick, level);
+        uint64_t to = level_index(now_tick, level);
+        uint64_t idx;
+
+        if (to - from > SLOT_MASK) {
+            to = from + SLOT_MASK;
+        }
+        for (idx = from; idx <= to; idx++) {
+            list_splice(&wheel[level][idx & SLOT_MASK], &moved);
+        }
+    }
+
+    cur_tick = now_tick;
+
+    // What isn't due yet goes back in, a level lower. What is fires in due
+    // order, not slot order: a late run can take several ticks at once
+    while (!list_empty(&moved)) {
+        struct timer *t = moved.next;
+
+        list_del(t);
+        if (t->due <= now) {
+            list_add_sorted(&expired, t);
+        } else {
+            wheel_add(t);
+        }
+    }
+
+    while (!list_empty(&expired)) {
+        struct timer *t = expired.next;
+
+        list_del(t);
+        count--;
+        t->fn(t->arg);
+    }
+}
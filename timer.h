@@ -0,0 +1,99 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#include "clock.h"
+
+/*
+ * One-shot timers on a hierarchical timing wheel, woken by a timerfd
+ *
+ * Level 0 has a slot per tick for the current run of TIMER_SLOTS ticks,
+ * and each level above has a slot per run of the level below. A timer
+ * goes in the lowest level whose slot can tell its tick from now, and
+ * moves down a level each time the wheel reaches that slot, so starting
+ * and stopping one is O(1) and a pass of timer_run() touches at most
+ * TIMER_SLOTS slots per level however long it has been. Timers further
+ * out than the top level reaches wait in its last slot. Ticks only group
+ * timers: each fires at its own due time, to the nanosecond the timerfd
+ * allows. Times are from now_ns().
+ */
+
+#define TIMER_TICK_NS NS_PER_MS
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4
+
+/* timer_next_due() when nothing is running */
+#define TIMER_IDLE UINT64_MAX
+
+/**
+ * A timer, embedded in whatever it times
+ * Initialize with timer_init() before use.
+ */
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint64_t due;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+/**
+ * Set up a stopped timer
+ * @param t the timer
+ * @param fn called with arg when the timer fires
+ * @param arg passed to fn
+ */
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg);
+
+/**
+ * Start a timer, or move it if it is already running
+ * @param t the timer
+ * @param due when it fires, from now_ns()
+ */
+void timer_start(struct timer *t, uint64_t due);
+
+/**
+ * Stop a timer, if it is running
+ */
+void timer_stop(struct timer *t);
+
+/**
+ * Whether a timer is running
+ */
+int timer_pending(const struct timer *t);
+
+/**
+ * When the next timer fires
+ * @return the due time, or TIMER_IDLE if no timer is running
+ */
+uint64_t timer_next_due(void);
+
+/**
+ * The timerfd that becomes readable when a timer is due
+ * Poll it for reading; timer_run() clears it.
+ * @return the fd, or -1 if it could not be created
+ */
+int timer_fd(void);
+
+/**
+ * Point the timerfd at the next due timer, if that has changed
+ * Call before waiting on timer_fd().
+ */
+void timer_arm(void);
+
+/**
+ * Fire every timer that is due, earliest first
+ * A callback may start and stop timers, including its own.
+ * @param now the current time, from now_ns()
+ */
+void timer_run(uint64_t now);
+
+#endif
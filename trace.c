@@ -0,0 +1,252 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "trace.h"
+
+/**
+ * One sampled frame: the time each stage was reached, 0 if it was not
+ */
+struct trace_rec {
+    uint32_t id;
+    uint64_t t[TRACE_NUM_STAGES];
+};
+
+struct trace_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t bucket[TRACE_HIST_BUCKETS];
+};
+
+static const char *stage_names[TRACE_NUM_STAGES] = {
+    "uart_read", "parsed", "dispatched", "kiss_encoded", "kiss_written",
+    "kiss_read", "kiss_decoded", "reply_encoded", "uart_written"
+};
+
+static unsigned sample_every;
+static uint32_t frame_count;
+static uint64_t last_read[TRACE_NUM_STAGES];
+
+static struct trace_rec ring[TRACE_RING_LEN];
+static uint32_t ring_head;
+static struct trace_rec *cur;
+static int cur_stage;  // the latest stage stamped on cur
+
+static struct trace_hist hist[TRACE_NUM_STAGES];
+static struct trace_hist total_hist[TRACE_NUM_STAGES];
+
+static void log_stderr(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+// Not the program's log_err()/log_info(), so liblfr.a stands alone
+static trace_log_fn trace_err = log_stderr;
+static trace_log_fn trace_info = log_stderr;
+
+static uint64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void hist_add(struct trace_hist *h, uint64_t ns)
+{
+    int b = 0;
+
+    while (b < TRACE_HIST_BUCKETS - 1 && (ns >> b) > 1) {
+        b++;
+    }
+
+    h->bucket[b]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) {
+        h->max = ns;
+    }
+}
+
+/* upper bound (ns) of the bucket holding the given fraction of samples */
+static uint64_t hist_pct(const struct trace_hist *h, double pct)
+{
+    uint64_t want = (uint64_t) (h->count * pct + 0.5);
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < TRACE_HIST_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= want && seen > 0) {
+            return (2ull << b) < h->max ? (2ull << b) : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+void trace_init(unsigned every)
+{
+    sample_every = every;
+}
+
+void trace_read(enum trace_stage src)
+{
+    if (sample_every) {
+        last_read[src] = trace_now();
+    }
+}
+
+void trace_begin(enum trace_stage src)
+{
+    if (!sample_every) {
+        return;
+    }
+
+    if (frame_count++ % sample_every) {
+        cur = NULL;
+        return;
+    }
+
+    cur = &ring[ring_head++ % TRACE_RING_LEN];
+    memset(cur, 0, sizeof(*cur));
+    cur->id = frame_count - 1;
+    cur->t[src] = last_read[src] ? last_read[src] : trace_now();
+    cur_stage = src;
+}
+
+void trace_point(enum trace_stage stage)
+{
+    // Stages come in order, so an earlier one is another frame's: an ARQ
+    // retransmission sent while a received frame is handled, say
+    if (cur && (int) stage > cur_stage) {
+        cur->t[stage] = trace_now();
+        cur_stage = stage;
+    }
+}
+
+void trace_end(void)
+{
+    int prev = -1;
+    int first = -1;
+    int i;
+
+    if (!cur) {
+        return;
+    }
+
+    for (i = 0; i < TRACE_NUM_STAGES; i++) {
+        if (!cur->t[i]) {
+            continue;
+        }
+        if (prev >= 0) {
+            hist_add(&hist[i], cur->t[i] - cur->t[prev]);
+            hist_add(&total_hist[i], cur->t[i] - cur->t[first]);
+        } else {
+            first = i;
+        }
+        prev = i;
+    }
+
+    cur = NULL;
+}
+
+void trace_set_log(trace_log_fn err, trace_log_fn info)
+{
+    trace_err = err;
+    trace_info = info;
+}
+
+int trace_dump(const char *path)
+{
+    FILE *f;
+    uint32_t n, i;
+    uint32_t written = 0;
+    int s;
+    int first_event = 1;
+
+    if (!sample_every) {
+        trace_err("Tracing is not enabled\n");
+        return -1;
+    }
+
+    f = fopen(path, "w");
+    if (!f) {
+        trace_err("ERROR opening trace file %s: %s\n", path,
+                  strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+
+    n = ring_head < TRACE_RING_LEN ? ring_head : TRACE_RING_LEN;
+    for (i = ring_head - n; i != ring_head; i++) {
+        struct trace_rec *r = &ring[i % TRACE_RING_LEN];
+        int prev = -1;
+
+        // Skip the frame still in flight
+        if (r == cur) {
+            continue;
+        }
+        written++;
+
+        for (s = 0; s < TRACE_NUM_STAGES; s++) {
+            if (!r->t[s]) {
+                continue;
+            }
+            if (prev >= 0) {
+                fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"frame\":%u}}",
+                        first_event ? "" : ",\n", stage_names[s],
+                        r->t[TRACE_UART_READ] ? "uplink" : "downlink",
+                        r->t[prev] / 1000.0, (r->t[s] - r->t[prev]) / 1000.0,
+                        r->t[TRACE_UART_READ] ? 1 : 2, r->id);
+                first_event = 0;
+            }
+            prev = s;
+        }
+    }
+
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (fclose(f)) {
+        trace_err("ERROR writing trace file %s: %s\n", path,
+                  strerror(errno));
+        return -1;
+    }
+
+    trace_info("Trace: %u frames seen, 1 in %u sampled, %u written to %s\n",
+               frame_count, sample_every, written, path);
+    trace_info("%-14s %8s %10s %10s %10s %10s %12s\n", "stage (us)",
+               "count", "mean", "p50", "p99", "max", "p99 from rx");
+
+    for (s = 0; s < TRACE_NUM_STAGES; s++) {
+        struct trace_hist *h = &hist[s];
+
+        if (!h->count) {
+            continue;
+        }
+
+        trace_info("%-14s %8llu %10.1f %10.1f %10.1f %10.1f %12.1f\n",
+                   stage_names[s], (unsigned long long) h->count,
+                   h->sum / (double) h->count / 1000.0,
+                   hist_pct(h, 0.5) / 1000.0, hist_pct(h, 0.99) / 1000.0,
+                   h->max / 1000.0, hist_pct(&total_hist[s], 0.99) / 1000.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Number of sampled frames kept for the Chrome trace dump */
+#define TRACE_RING_LEN 4096
+
+/* Number of log2(ns) latency histogram buckets per stage */
+#define TRACE_HIST_BUCKETS 40
+
+/**
+ * Trace points, in the order a frame passes them
+ * Uplink frames start at TRACE_UART_READ, downlink frames at TRACE_KISS_READ.
+ * Both end with the reply to the client.
+ */
+enum trace_stage {
+    TRACE_UART_READ,
+    TRACE_PARSED,
+    TRACE_DISPATCHED,
+    TRACE_KISS_ENCODED,
+    TRACE_KISS_WRITTEN,
+    TRACE_KISS_READ,
+    TRACE_KISS_DECODED,
+    TRACE_REPLY_ENCODED,
+    TRACE_UART_WRITTEN,
+    TRACE_NUM_STAGES
+};
+
+/**
+ * printf-style logger for trace_dump()'s report
+ */
+typedef void (*trace_log_fn)(const char *fmt, ...);
+
+/**
+ * Send trace_dump()'s errors and report to the program's log
+ * Both go to stderr until this is called.
+ * @param err logs errors
+ * @param info logs the report
+ */
+void trace_set_log(trace_log_fn err, trace_log_fn info);
+
+/**
+ * Enable tracing
+ * @param sample_every trace one in this many frames (0 disables tracing)
+ */
+void trace_init(unsigned sample_every);
+
+/**
+ * Note that a read() on a source fd returned data
+ * @param src TRACE_UART_READ or TRACE_KISS_READ
+ */
+void trace_read(enum trace_stage src);
+
+/**
+ * Start a frame, timed from the last read on its source
+ * @param src TRACE_UART_READ or TRACE_KISS_READ
+ */
+void trace_begin(enum trace_stage src);
+
+/**
+ * Timestamp a stage of the current frame, if it is being sampled; a stage
+ * no later than one already stamped belongs to another frame and is ignored
+ * @param stage the stage the frame just completed
+ */
+void trace_point(enum trace_stage stage);
+
+/**
+ * Finish the current frame, updating the histograms
+ */
+void trace_end(void);
+
+/**
+ * Write the sampled frames as Chrome trace-event JSON and log the
+ * per-stage latency histograms
+ * @param path the JSON file to write
+ * @return 0 on success, -1 on error
+ */
+int trace_dump(const char *path);
+
+#endif
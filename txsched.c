@@ -0,0 +1,237 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lfr-tcp.h"
+#include "clock.h"
+#include "txsched.h"
+
+struct txsched_entry {
+    struct timer timer;
+    uint64_t due;       // as scheduled; retries move only the timer
+    uint8_t used;
+    uint8_t past;
+    uint8_t refused;    // the link had no room; later frames wait for it
+    uint8_t waiting;    // due, held behind a refused frame for its port
+    uint8_t port;
+    uint8_t len;
+    uint8_t data[TXSCHED_BUF_SIZE];
+};
+
+struct txsched_state {
+    int free_count;
+    int16_t free[TXSCHED_MAX];
+    struct txsched_entry e[TXSCHED_MAX];
+    struct txsched_stats stats[KISS_MAX_PORTS];
+};
+
+_Static_assert(sizeof(struct txsched_state) <= TXSCHED_STATE_MAX,
+               "TXSCHED_STATE_MAX is too small");
+
+static struct txsched_state sched;
+static txsched_xmit_fn xmit;
+
+static void entry_free(struct txsched_entry *e)
+{
+    timer_stop(&e->timer);
+    e->used = 0;
+    sched.stats[e->port].pending--;
+    sched.free[sched.free_count++] = e - sched.e;
+}
+
+/* The refused frame a port's later frames wait behind, if any */
+static struct txsched_entry *port_refused(int port)
+{
+    int i;
+
+    for (i = 0; i < TXSCHED_MAX; i++) {
+        if (sched.e[i].used && sched.e[i].refused &&
+            sched.e[i].port == port) {
+            return &sched.e[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* The earliest frame waiting behind a port's refused one */
+static struct txsched_entry *port_waiting(int port)
+{
+    struct txsched_entry *first = NULL;
+    int i;
+
+    for (i = 0; i < TXSCHED_MAX; i++) {
+        struct txsched_entry *e = &sched.e[i];
+
+        if (e->used && e->waiting && e->port == port &&
+            (!first || e->due < first->due)) {
+            first = e;
+        }
+    }
+
+    return first;
+}
+
+/**
+ * Hand a frame to the link
+ * @return 0 if it is done with, -2 if the link refused it and it will be
+ * tried again
+ */
+static int send_entry(struct txsched_entry *e)
+{
+    struct txsched_stats *st = &sched.stats[e->port];
+    uint64_t jitter;
+    int err;
+
+    err = xmit(e->port, e->data, e->len);
+    if (err == -2) {
+        // Stays at the head of its port's queue
+        e->refused = 1;
+        e->waiting = 0;
+        timer_start(&e->timer, now_ns() + TXSCHED_RETRY_NS);
+        return -2;
+    }
+
+    if (err < 0) {
+        log_err("ERROR sending scheduled frame on KISS port %d\n", e->port);
+        st->dropped++;
+    } else if (e->past) {
+        st->sent++;
+        st->past++;
+    } else {
+        jitter = now_ns() - e->due;
+        if (st->sent == st->past || jitter < st->jitter_min) {
+            st->jitter_min = jitter;
+        }
+        if (jitter > st->jitter_max) {
+            st->jitter_max = jitter;
+        }
+        st->jitter_sum += jitter;
+        st->sent++;
+    }
+
+    entry_free(e);
+    return 0;
+}
+
+static void release(void *arg)
+{
+    struct txsched_entry *e = arg;
+    struct txsched_entry *head = port_refused(e->port);
+    int port = e->port;
+
+    // Nothing overtakes a refused frame, however soon it is due
+    if (head && head != e) {
+        e->waiting = 1;
+        return;
+    }
+
+    if (send_entry(e) < 0) {
+        return;
+    }
+
+    // Then what came due behind it, in order, until the link refuses one
+    while ((e = port_waiting(port)) != NULL) {
+        if (send_entry(e) < 0) {
+            break;
+        }
+    }
+}
+
+void txsched_init(txsched_xmit_fn xmit_fn)
+{
+    int i;
+
+    xmit = xmit_fn;
+    memset(&sched, 0, sizeof(sched));
+
+    for (i = 0; i < TXSCHED_MAX; i++) {
+        sched.free[i] = TXSCHED_MAX - 1 - i;
+        timer_init(&sched.e[i].timer, release, &sched.e[i]);
+    }
+    sched.free_count = TXSCHED_MAX;
+}
+
+int txsched_add(int port, uint64_t due, const uint8_t *buf, int len)
+{
+    struct txsched_entry *e;
+    uint64_t now = now_ns();
+
+    if (len > TXSCHED_BUF_SIZE || port < 0 || port >= KISS_MAX_PORTS) {
+        return -1;
+    }
+
+    if (sched.free_count == 0) {
+        return -2;
+    }
+
+    e = &sched.e[sched.free[--sched.free_count]];
+    e->used = 1;
+    e->past = due <= now;
+    e->refused = 0;
+    e->waiting = 0;
+    e->due = due;
+    e->port = port;
+    e->len = len;
+    memcpy(e->data, buf, len);
+    sched.stats[port].pending++;
+
+    timer_start(&e->timer, due);
+
+    return 0;
+}
+
+int txsched_cancel(int port)
+{
+    int n = 0;
+    int i;
+
+    for (i = 0; i < TXSCHED_MAX; i++) {
+        if (sched.e[i].used && sched.e[i].port == port) {
+            entry_free(&sched.e[i]);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+const struct txsched_stats *txsched_stats(int port)
+{
+    return &sched.stats[port];
+}
+
+const void *txsched_export(int *len)
+{
+    *len = sizeof(sched);
+    return &sched;
+}
+
+int txsched_import(const void *buf, int len)
+{
+    int i;
+
+    if (len != sizeof(sched)) {
+        return -1;
+    }
+
+    memcpy(&sched, buf, len);
+
+    // The timers came over as plain data. Those already due fire at once,
+    // still in due order
+    for (i = 0; i < TXSCHED_MAX; i++) {
+        struct txsched_entry *e = &sched.e[i];
+
+        timer_init(&e->timer, release, e);
+        if (e->used) {
+            timer_start(&e->timer, e->due);
+        }
+    }
+
+    return 0;
+}
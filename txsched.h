@@ -0,0 +1,92 @@
+/* Little Free Radio - An Open Source Radio for CubeSats
+ * Copyright (C) 2018 Grant Iraci, Brian Bezanson
+ * A project of the University at Buffalo Nanosatellite Laboratory
+ * See LICENSE for details
+ */
+
+#ifndef TXSCHED_H
+#define TXSCHED_H
+
+#include <stdint.h>
+
+#include "timer.h"
+
+/*
+ * Frames held for transmission at a set time
+ *
+ * Each frame waits on its own timer and is handed to the transmit path
+ * when it fires. A frame the link has no room for is tried again every
+ * TXSCHED_RETRY_NS, and later frames for its port wait behind it. How far
+ * after its time each frame actually went out is kept per port.
+ */
+
+/* Frames held at once, for all ports */
+#define TXSCHED_MAX 256
+#define TXSCHED_BUF_SIZE 255
+
+#define TXSCHED_RETRY_NS (1 * NS_PER_MS)
+
+/* Upper bound on the size of txsched_export() */
+#define TXSCHED_STATE_MAX (TXSCHED_MAX * (TXSCHED_BUF_SIZE + 64) + 2048)
+
+/**
+ * Timing of the scheduled frames sent on one port
+ */
+struct txsched_stats {
+    uint32_t sent;
+    uint32_t past;          // already due when scheduled, not in the jitter
+    uint32_t dropped;       // the link refused them
+    uint16_t pending;
+    uint64_t jitter_min;    // ns after the due time a frame went out
+    uint64_t jitter_max;
+    uint64_t jitter_sum;
+};
+
+/**
+ * Transmit a frame
+ * @return 0 on success, -1 on error, -2 if the link is backed up
+ */
+typedef int (*txsched_xmit_fn)(int port, const uint8_t *buf, int len);
+
+/**
+ * Set the transmit callback and drop every held frame
+ */
+void txsched_init(txsched_xmit_fn xmit);
+
+/**
+ * Hold a frame until a time
+ * @param port the port to send it on
+ * @param due when to send it, from now_ns()
+ * @param buf the frame
+ * @param len the length of the frame
+ * @return 0 on success, -1 if it is too long, -2 if the schedule is full
+ */
+int txsched_add(int port, uint64_t due, const uint8_t *buf, int len);
+
+/**
+ * Drop every frame held for a port
+ * @return the number dropped
+ */
+int txsched_cancel(int port);
+
+/**
+ * Timing statistics for a port
+ */
+const struct txsched_stats *txsched_stats(int port);
+
+/**
+ * The held frames and statistics, for handing off to a new process
+ * @param len set to the size of the state
+ * @return the state
+ */
+const void *txsched_export(int *len);
+
+/**
+ * Take over held frames from another process and start their timers
+ * @param buf the state from txsched_export()
+ * @param len its size
+ * @return 0 on success, -1 if the size does not match
+ */
+int txsched_import(const void *buf, int len);
+
+#endif